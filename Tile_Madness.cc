@@ -3,10 +3,24 @@
 #include <cassert>
 #include <cmath> 
 #include <cstdio>
+#include <cstring>
 #include "legion.h"
+#include "default_mapper.h"
+#include "tree_index.h"
+#include "leaf_kernels.h"
+#include "node_random.h"
+#include "tree_dump.h"
 #include <vector>
-#include <queue>
+#include <map>
+#include <set>
+#include <string>
 #include <utility>
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 using namespace Legion;
 using namespace std;
@@ -17,32 +31,60 @@ enum TASK_IDs{
     TOP_LEVEL_TASK_ID,
     REFINE_INTER_TASK_ID,
     REFINE_INTRA_TASK_ID,
-    PRINT_TASK_ID,
-    COMPRESS_INTRA_TASK_ID,
-    COMPRESS_INTER_TASK_ID,
-    RECONSTRUCT_INTER_TASK_ID,
-    RECONSTRUCT_INTRA_TASK_ID,
+    REFINE_CHILDREN_TASK_ID,
+    DUMP_TASK_ID,
+    COMPRESS_TASK_ID,
+    RECONSTRUCT_TASK_ID,
     NORM_TASK_ID,
     INNER_PRODUCT_TASK_ID,
-    GAXPY_INTER_TASK_ID,
-    GAXPY_INTRA_TASK_ID,
+    GAXPY_TASK_ID,
+    RESTORE_TASK_ID,
+    GAXPY_BATCH_TASK_ID,
+    INNER_PRODUCT_BATCH_TASK_ID,
+    SUM_RESULT_TASK_ID,
+    BATCH_SUM_RESULT_TASK_ID,
+    PLAN_TASK_ID,
+    NUM_TASK_IDS,
+};
+
+// Registered under these names, so the counter report and Legion Prof agree.
+const char *task_names[NUM_TASK_IDS] = {
+    "top_level", "refine_inter", "refine_intra", "refine_children", "dump", "compress",
+    "reconstruct", "norm", "inner_product", "gaxpy", "restore", "gaxpy_batch", "inner_product_batch",
+    "sum_result", "batch_sum_result", "plan",
 };
 
 enum FieldId{
-    FID_X,
+    FID_COEFFS,
+    FID_IS_LEAF,
+    FID_SUM,    // the one field of the accumulators of norm, inner product and reconstruct
+    FID_TILE,   // the entry of a tile in a tree plan
+    FID_TILE_VALUE, // the compressed root value of a tile, next to its plan entry
+    FID_TILE_PASS,  // what a tile's parent hands down to it; FID_TILE_PASS+k for batch pair k
+};
+
+// Coefficients carried by every node; build with -DNUM_COEFFS=k to change the block width.
+#ifndef NUM_COEFFS
+#define NUM_COEFFS 8
+#endif
+
+struct Coefficients{
+    double c[NUM_COEFFS];
 };
 
 struct Arguments {
     int n;
-    int l;
+    coord_t l;
     int max_depth;
     coord_t idx;
     long int gen;
     Color partition_color;
     int actual_max_depth;
     int tile_height;
-    Arguments(int _n, int _l, int _max_depth, coord_t _idx, Color _partition_color, int _actual_max_depth=0, int _tile_height=1 )
-        : n(_n), l(_l), max_depth(_max_depth), idx(_idx), partition_color(_partition_color), actual_max_depth(_actual_max_depth), tile_height(_tile_height)
+    coord_t grain;
+    double refine_prob;
+    Arguments(int _n, coord_t _l, int _max_depth, coord_t _idx, Color _partition_color, int _actual_max_depth=0, int _tile_height=1 )
+        : n(_n), l(_l), max_depth(_max_depth), idx(_idx), gen(0), partition_color(_partition_color), actual_max_depth(_actual_max_depth), tile_height(_tile_height), grain(0), refine_prob(0.7)
     {
         if (_actual_max_depth == 0) {
             actual_max_depth = _max_depth;
@@ -50,17 +92,19 @@ struct Arguments {
     }
 };
 
-struct InnerProductArgs{
+struct GaxpyArgs{
     int n;
-    int l;
+    coord_t l;
     int max_depth;
     coord_t idx;
-    long int gen;
-    Color partition_color1, partition_color2;
+    Coefficients pass;
     int actual_max_depth;
     int tile_height;
-    InnerProductArgs(int _n, int _l, int _max_depth, coord_t _idx, Color _partition_color1, Color _partition_color2, int _actual_max_depth=0, int _tile_height=1 )
-        : n(_n), l(_l), max_depth(_max_depth), idx(_idx), partition_color1(_partition_color1), partition_color2(_partition_color2), actual_max_depth(_actual_max_depth), tile_height(_tile_height)
+    bool left_null, right_null;
+    double alpha, beta;
+    bool in_place;      // tree1 = alpha*tree1 + beta*tree2, with no tree3
+    GaxpyArgs(int _n, coord_t _l, int _max_depth, coord_t _idx, const Coefficients &_pass, bool _left_null, bool _right_null, int _actual_max_depth=0, int _tile_height=1, double _alpha=1.0, double _beta=1.0, bool _in_place=false )
+        : n(_n), l(_l), max_depth(_max_depth), idx(_idx), pass(_pass), left_null(_left_null), right_null(_right_null), actual_max_depth(_actual_max_depth), tile_height(_tile_height), alpha(_alpha), beta(_beta), in_place(_in_place)
     {
         if (_actual_max_depth == 0) {
             actual_max_depth = _max_depth;
@@ -68,78 +112,1648 @@ struct InnerProductArgs{
     }
 };
 
-struct GaxpyArgs{
-    int n;
-    int l;
+// Batched gaxpy runs up to MAX_BATCH operand tuples per launch of a level, over the tiles that
+// any tuple has: a tile task serves every tuple whose result has that tile. All trees of a batch
+// share max_depth and tile_height. The batched inner product serves up to MAX_BATCH pairs the
+// same way.
+const int MAX_BATCH = 32;
+
+struct BatchGaxpyArgs{
     int max_depth;
-    coord_t idx;
-    long int gen;
-    Color partition_color1, partition_color2, partition_color3;
-    int pass;
     int actual_max_depth;
     int tile_height;
+    int count;
+    double alpha[MAX_BATCH], beta[MAX_BATCH];
+    BatchGaxpyArgs(int _max_depth, int _actual_max_depth, int _tile_height, int _count)
+        : max_depth(_max_depth), actual_max_depth(_actual_max_depth), tile_height(_tile_height), count(_count) {}
+};
+
+// Node coefficients and leaf flags live in separate fields so a task only maps the data it uses.
+template<PrivilegeMode VALUE_MODE, PrivilegeMode LEAF_MODE>
+struct TreeAccessor{
+    FieldAccessor<VALUE_MODE,Coefficients,1,coord_t,Realm::AffineAccessor<Coefficients,1,coord_t> > coeffs;
+    FieldAccessor<LEAF_MODE,bool,1,coord_t,Realm::AffineAccessor<bool,1,coord_t> > is_leaf;
+    TreeAccessor() {}
+    TreeAccessor( const PhysicalRegion &region ) : coeffs(region, FID_COEFFS), is_leaf(region, FID_IS_LEAF) {}
+};
+
+
+// A bottom-row node of a tile whose two children root new tiles. The tile walk also keeps one
+// per level of its path, so it holds only the position of the node.
+struct FrontierEntry{
+    int n;
+    coord_t l;
+    coord_t idx;
+    FrontierEntry() : n(0), l(0), idx(0) {}
+    FrontierEntry( int _n, coord_t _l, coord_t _idx ) : n(_n), l(_l), idx(_idx) {}
+};
+
+// What gaxpy and reconstruct hand down from a frontier node to both of its child tiles. The
+// pass only means something to gaxpy once one of the null flags is set.
+struct FrontierPass{
+    Coefficients pass;
     bool left_null, right_null;
-    GaxpyArgs(int _n, int _l, int _max_depth, coord_t _idx, Color _partition_color1, Color _partition_color2, Color _partition_color3, int _pass, bool _left_null, bool _right_null, int _actual_max_depth=0, int _tile_height=1 )
-        : n(_n), l(_l), max_depth(_max_depth), idx(_idx), partition_color1(_partition_color1), partition_color2(_partition_color2), partition_color3(_partition_color3) ,pass(_pass), left_null(_left_null), right_null(_right_null), actual_max_depth(_actual_max_depth), tile_height(_tile_height)
+    FrontierPass() : pass(), left_null(false), right_null(false) {}
+    FrontierPass( const Coefficients &_pass, bool _left_null, bool _right_null ) : pass(_pass), left_null(_left_null), right_null(_right_null) {}
+};
+
+// Child tiles of a walked tile. Refine and plan tasks return it as a future value, so the next
+// launch is built without a helper region or an inline mapping; the other tile tasks keep it
+// local. Reconstruct also sums the squares of the tile it walked and refine counts the nodes it
+// made. Gaxpy and reconstruct add the pass of every entry, in the same order, for the plan
+// entries of the child tiles; the other operators leave passes empty.
+struct Frontier{
+    vector<FrontierEntry> entries;
+    vector<FrontierPass> passes;
+    double sum_squares;
+    coord_t nodes;
+    Frontier() : sum_squares(0.0), nodes(0) {}
+    static size_t header_size(void) {
+        return sizeof(double) + sizeof(coord_t) + 2 * sizeof(size_t);
+    }
+    size_t legion_buffer_size(void) const {
+        return header_size() + entries.size() * sizeof(FrontierEntry) + passes.size() * sizeof(FrontierPass);
+    }
+    size_t legion_serialize(void *buffer) const {
+        char *ptr = static_cast<char *>(buffer);
+        size_t count = entries.size();
+        size_t pass_count = passes.size();
+        memcpy(ptr, &sum_squares, sizeof(double));
+        memcpy(ptr + sizeof(double), &nodes, sizeof(coord_t));
+        memcpy(ptr + sizeof(double) + sizeof(coord_t), &count, sizeof(size_t));
+        memcpy(ptr + sizeof(double) + sizeof(coord_t) + sizeof(size_t), &pass_count, sizeof(size_t));
+        if( count > 0 )
+            memcpy(ptr + header_size(), &entries[0], count * sizeof(FrontierEntry));
+        if( pass_count > 0 )
+            memcpy(ptr + header_size() + count * sizeof(FrontierEntry), &passes[0], pass_count * sizeof(FrontierPass));
+        return legion_buffer_size();
+    }
+    size_t legion_deserialize(const void *buffer) {
+        const char *ptr = static_cast<const char *>(buffer);
+        size_t count, pass_count;
+        memcpy(&sum_squares, ptr, sizeof(double));
+        memcpy(&nodes, ptr + sizeof(double), sizeof(coord_t));
+        memcpy(&count, ptr + sizeof(double) + sizeof(coord_t), sizeof(size_t));
+        memcpy(&pass_count, ptr + sizeof(double) + sizeof(coord_t) + sizeof(size_t), sizeof(size_t));
+        entries.resize(count);
+        passes.resize(pass_count);
+        if( count > 0 )
+            memcpy(&entries[0], ptr + header_size(), count * sizeof(FrontierEntry));
+        if( pass_count > 0 )
+            memcpy(&passes[0], ptr + header_size() + count * sizeof(FrontierEntry), pass_count * sizeof(FrontierPass));
+        return legion_buffer_size();
+    }
+};
+
+// Inner products of a batch, one per operand pair.
+struct BatchSum{
+    double v[MAX_BATCH];
+    BatchSum() {
+        for( int k = 0 ; k < MAX_BATCH ; k++ )
+            v[k] = 0.0;
+    }
+};
+
+// Norm, inner product and reconstruct add the sum of every tile into an accumulator region with
+// this reduction, so no tile task waits on its children to return a total.
+enum ReductionOpIDs{
+    SUM_REDOP_ID = 1,
+};
+
+struct SumReduction{
+    typedef double LHS;
+    typedef double RHS;
+    static const double identity;
+    template<bool EXCLUSIVE> static void apply(LHS &lhs, RHS rhs);
+    template<bool EXCLUSIVE> static void fold(RHS &rhs1, RHS rhs2);
+};
+
+const double SumReduction::identity = 0.0;
+
+static void atomic_add_double(double *target, double value){
+    unsigned long long *bits = reinterpret_cast<unsigned long long *>(target);
+    unsigned long long old_bits = *bits, new_bits;
+    do{
+        double sum;
+        memcpy(&sum, &old_bits, sizeof(double));
+        sum = sum + value;
+        memcpy(&new_bits, &sum, sizeof(double));
+    }while( !__atomic_compare_exchange_n(bits, &old_bits, new_bits, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED) );
+}
+
+template<> void SumReduction::apply<true>(LHS &lhs, RHS rhs){
+    lhs = lhs + rhs;
+}
+
+template<> void SumReduction::apply<false>(LHS &lhs, RHS rhs){
+    atomic_add_double(&lhs, rhs);
+}
+
+template<> void SumReduction::fold<true>(RHS &rhs1, RHS rhs2){
+    rhs1 = rhs1 + rhs2;
+}
+
+template<> void SumReduction::fold<false>(RHS &rhs1, RHS rhs2){
+    atomic_add_double(&rhs1, rhs2);
+}
+
+// Accumulators hold one double per slot: slot 0 for norm, inner product and reconstruct, slot k
+// for pair k of a batched inner product. Tile tasks map them with reduce privilege and add their
+// own sums; sibling tasks and the launches of other levels reduce into the same region without
+// any ordering between them. Tasks that only pass the region on to their children take it with
+// NO_ACCESS_FLAG. The caller reads the total with a sum_result task, which Legion orders after
+// every reduction.
+void clear_sums(HighLevelRuntime *runtime, Context ctx, LogicalRegion sum){
+    runtime->fill_field<double>(ctx, sum, sum, FID_SUM, 0.0);
+}
+
+LogicalRegion create_sum_region(HighLevelRuntime *runtime, Context ctx, int slots){
+    IndexSpace is = runtime->create_index_space(ctx, Rect<1>(0, slots - 1));
+    FieldSpace fs = runtime->create_field_space(ctx);
     {
-        if (_actual_max_depth == 0) {
-            actual_max_depth = _max_depth;
+        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
+        allocator.allocate_field(sizeof(double), FID_SUM);
+    }
+    LogicalRegion sum = runtime->create_logical_region(ctx, is, fs);
+    clear_sums(runtime, ctx, sum);
+    return sum;
+}
+
+void destroy_sum_region(HighLevelRuntime *runtime, Context ctx, LogicalRegion sum){
+    runtime->destroy_logical_region(ctx, sum);
+    runtime->destroy_field_space(ctx, sum.get_field_space());
+    runtime->destroy_index_space(ctx, sum.get_index_space());
+}
+
+RegionRequirement sum_requirement(LogicalRegion sum){
+    RegionRequirement req(sum, SUM_REDOP_ID, EXCLUSIVE, sum);
+    req.add_field(FID_SUM);
+    return req;
+}
+
+// Adds value into slot of an accumulator the task got with sum_requirement.
+void add_sum(const PhysicalRegion &sum, int slot, double value){
+    const ReductionAccessor<SumReduction,false,1,coord_t,Realm::AffineAccessor<double,1,coord_t> > acc(sum, FID_SUM, SUM_REDOP_ID);
+    acc[slot] <<= value;
+}
+
+double sum_result_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    const FieldAccessor<READ_ONLY,double,1,coord_t,Realm::AffineAccessor<double,1,coord_t> > sum(regions[0], FID_SUM);
+    return sum[0];
+}
+
+BatchSum batch_sum_result_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    const FieldAccessor<READ_ONLY,double,1,coord_t,Realm::AffineAccessor<double,1,coord_t> > sum(regions[0], FID_SUM);
+    BatchSum result;
+    for( int k = 0 ; k < MAX_BATCH ; k++ )
+        result.v[k] = sum[k];
+    return result;
+}
+
+// Future of the total in sum, with task_id SUM_RESULT_TASK_ID for a double or
+// BATCH_SUM_RESULT_TASK_ID for a BatchSum.
+Future sum_result(HighLevelRuntime *runtime, Context ctx, LogicalRegion sum, TaskID task_id){
+    TaskLauncher result_launcher(task_id, TaskArgument(NULL, 0));
+    result_launcher.add_region_requirement(RegionRequirement(sum, READ_ONLY, EXCLUSIVE, sum));
+    result_launcher.add_field(0, FID_SUM);
+    return runtime->execute_task(ctx, result_launcher);
+}
+
+// Trees are stored in a tiled preorder layout. Tiles are tile_height levels deep and rooted at
+// depths 0, tile_height, 2*tile_height, ... Each tile keeps its nodes in one contiguous block
+// (left child at idx+1, right child at idx+2^(levels-r-1) for relative depth r), followed by the
+// subtrees of its 2^levels possible child tiles. Every subtree region is split by a partition
+// (registered under the tree's partition color) into the tile block and the child subtrees, so
+// only the blocks of tiles that refinement actually creates ever get a physical instance.
+enum TileColor{
+    TILE_BLOCK_COLOR = 0,   // child tile j is colored j+1
+};
+
+// Index launches below the root tile are tagged so TileMapper deals their points across the
+// processor groups; deeper launches stay in the group of the launching processor. Launches over
+// a whole level of a tree plan are tagged so it splits them into runs of neighbouring tiles.
+enum MappingTags{
+    TILE_SPREAD_TAG = 1,
+    TILE_LEVEL_TAG = 2,     // the points are the tiles of one level of a tree plan
+};
+
+MappingTagID tile_launch_tag(int n){
+    return n == 0 ? TILE_SPREAD_TAG : 0;
+}
+
+// The coloring depends only on where the tile sits, not on the tree structure, so a region that
+// already has the partition (a gaxpy output written again, a tile added to tree1 once more) keeps
+// it. Partitions stay the same across iterations instead of piling up.
+LogicalPartition create_tile_partition(HighLevelRuntime *runtime, Context ctx, LogicalRegion lr, int max_depth, int n, coord_t idx, int tile_height, Color partition_color){
+    if( runtime->has_logical_partition_by_color(ctx, lr, partition_color) )
+        return runtime->get_logical_partition_by_color(ctx, lr, partition_color);
+    int levels = tile_levels(max_depth, n, tile_height);
+    coord_t block = tile_extent(max_depth, n, tile_height);
+    DomainPointColoring coloring;
+    coloring[TILE_BLOCK_COLOR] = Rect<1>(idx, idx + block - 1);
+    if( n + levels <= max_depth ){
+        coord_t child_extent = subtree_extent(max_depth, n + levels);
+        for( int j = 0 ; j < (1<<levels) ; j++ ){
+            coord_t child_idx = idx + block + j * child_extent;
+            coloring[j+1] = Rect<1>(child_idx, child_idx + child_extent - 1);
+        }
+    }
+    Rect<1> color_space(0, 1<<levels);
+    IndexPartition ip = runtime->create_index_partition(ctx, lr.get_index_space(), color_space, coloring, DISJOINT_KIND, partition_color);
+    return runtime->get_logical_partition(ctx, lr, ip);
+}
+
+vector<int> frontier_positions(const Frontier &frontier, int tile_root){
+    vector<int> positions;
+    for( size_t i = 0 ; i < frontier.entries.size() ; i++ ){
+        for( int side = 0 ; side < 2 ; side++ )
+            positions.push_back(child_tile_position(tile_root, frontier.entries[i].n, frontier.entries[i].l, side));
+    }
+    return positions;
+}
+
+// Work counters, one slot per local processor. A LOC_PROC runs one task at a time, so its slot
+// takes plain increments with no lock or atomic, and slots are cache-line aligned so processors
+// never write the same line. Readers sum the slots once the tasks are done (after a fence).
+const int MAX_COUNTER_SLOTS = 256;
+const int MAX_TILE_LEVELS = 64;
+
+struct alignas(64) ProcCounters{
+    long long tasks[NUM_TASK_IDS];
+    long long task_us[NUM_TASK_IDS];
+    long long node_visits;
+    long long leaves;           // visits that did not descend
+    long long tiles;
+    long long tile_slots;       // capacity of the walked tile blocks
+    long long frontier_entries;
+    long long frontier_slots;   // bottom-row nodes of walked tiles that have child tiles
+    long long launches;
+    long long launch_points;
+    long long level_visits[MAX_TILE_LEVELS];
+    long long level_us[MAX_TILE_LEVELS];
+    void add(const ProcCounters &other){
+        const long long *from = &other.tasks[0];
+        long long *to = &tasks[0];
+        for( size_t i = 0 ; i < sizeof(ProcCounters) / sizeof(long long) ; i++ )
+            to[i] = to[i] + from[i];
+    }
+    long long total_tasks() const {
+        long long total = 0;
+        for( int i = 0 ; i < NUM_TASK_IDS ; i++ )
+            total = total + tasks[i];
+        return total;
+    }
+};
+
+ProcCounters counter_slots[MAX_COUNTER_SLOTS];
+std::map<Processor, int> counter_slot_of;
+thread_local ProcCounters *current_counters = NULL;
+
+// Called from the registration callback, before any task runs.
+void assign_counter_slots(const std::set<Processor> &local_procs){
+    for( std::set<Processor>::const_iterator it = local_procs.begin() ; it != local_procs.end() ; it++ ){
+        int slot = static_cast<int>(counter_slot_of.size());
+        assert( slot < MAX_COUNTER_SLOTS );
+        counter_slot_of[*it] = slot;
+    }
+}
+
+ProcCounters sum_counters(){
+    ProcCounters total = ProcCounters();
+    for( size_t i = 0 ; i < counter_slot_of.size() ; i++ )
+        total.add(counter_slots[i]);
+    return total;
+}
+
+// Points the walks of this task at the slot of its processor and charges the task's wall time
+// to its task ID on the way out.
+struct TaskProbe{
+    int slot;
+    ProcCounters *counters;
+    TaskID task_id;
+    long long start_us;
+    TaskProbe(HighLevelRuntime *runtime, Context ctx, TaskID _task_id) : task_id(_task_id), start_us(Realm::Clock::current_time_in_microseconds()) {
+        std::map<Processor, int>::const_iterator slot = counter_slot_of.find(runtime->get_executing_processor(ctx));
+        assert( slot != counter_slot_of.end() );
+        this->slot = slot->second;
+        counters = &counter_slots[slot->second];
+        current_counters = counters;
+        counters->tasks[task_id]++;
+    }
+    ~TaskProbe(){
+        counters->task_us[task_id] += Realm::Clock::current_time_in_microseconds() - start_us;
+    }
+};
+
+// Sums every processor's slot once all tasks have finished and prints it. Task times of inter
+// tasks include waiting for their children; the per-level times are tile walks only.
+void print_counter_report(HighLevelRuntime *runtime, Context ctx, int tile_height){
+    runtime->issue_execution_fence(ctx).get_void_result();
+    ProcCounters total = sum_counters();
+    printf("Counters over %zu processors\n", counter_slot_of.size());
+    printf("%-20s %10s %14s %12s\n", "task", "count", "total_us", "mean_us");
+    for( int i = 0 ; i < NUM_TASK_IDS ; i++ )
+        if( total.tasks[i] > 0 )
+            printf("%-20s %10lld %14lld %12.1f\n", task_names[i], total.tasks[i], total.task_us[i], static_cast<double>(total.task_us[i]) / total.tasks[i]);
+    if( total.tiles > 0 ){
+        printf("node visits %lld: %lld leaves, %lld interior, %.1f per tile\n", total.node_visits, total.leaves, total.node_visits - total.leaves, static_cast<double>(total.node_visits) / total.tiles);
+        printf("tile fill %.1f%% of %lld slots over %lld tiles\n", 100.0 * total.node_visits / total.tile_slots, total.tile_slots, total.tiles);
+    }
+    if( total.frontier_slots > 0 )
+        printf("frontier fill %.1f%% (%lld of %lld bottom-row nodes)\n", 100.0 * total.frontier_entries / total.frontier_slots, total.frontier_entries, total.frontier_slots);
+    if( total.launches > 0 )
+        printf("index launches %lld, mean fan-out %.1f\n", total.launches, static_cast<double>(total.launch_points) / total.launches);
+    printf("%-8s %14s %12s\n", "depth", "node_visits", "walk_us");
+    for( int level = 0 ; level < MAX_TILE_LEVELS ; level++ )
+        if( total.level_visits[level] > 0 )
+            printf("%-8d %14lld %12lld\n", level * tile_height, total.level_visits[level], total.level_us[level]);
+}
+
+void count_launch(size_t points){
+    if( current_counters == NULL )
+        return;
+    current_counters->launches++;
+    current_counters->launch_points += points;
+}
+
+// Tiles deeper than this are rejected at startup; the scan below keeps one path record per
+// level of the tile.
+const int MAX_TILE_HEIGHT = 30;
+
+// Walk over one tile block as a forward scan in memory order. The block is laid out in preorder,
+// so the node after idx is its left child at idx+1 when it is expanded; otherwise the scan jumps
+// over the index extent of its subtree to the next sibling. The path from the tile root keeps the
+// (n, l, idx) of each node, so no per-node allocation or argument struct copies. For every node
+// the visitor's visit(node) does the operator's work and returns whether the node has children;
+// anything the children inherit the visitor keeps itself, per depth. Interior nodes on the bottom
+// row of the tile are handed to frontier(node) instead of being expanded. Visitors with
+// post_order set also get leave(node, right) once both children of an expanded node are done,
+// with the path record of its right child; the left child is left_child(node.idx), so visitors
+// never work out child indices of their own. Before each visit the visitor is asked to prefetch(idx) both nodes the scan can go to next.
+template<typename Index, typename Visitor>
+void scan_tile(const Index &index, int max_depth, const FrontierEntry &root, Visitor &visitor){
+    FrontierEntry path[MAX_TILE_HEIGHT];
+    int tile_root = root.n;
+    int tile_height = index.height();
+    int levels = index.levels(max_depth, tile_root);
+    coord_t end = root.idx + pow2(levels) - 1;
+    long long visited = 0;
+    long long leaves = 0;
+    long long frontier_entries = 0;
+    long long start_us = current_counters ? Realm::Clock::current_time_in_microseconds() : 0;
+    int r = 0;
+    coord_t branches = 0;   // bit k set when the path turns right at relative depth r-k
+    coord_t idx = root.idx;
+    path[0] = root;
+    while( true ){
+        FrontierEntry &node = path[r];
+        if( r > 0 )
+            node = FrontierEntry(tile_root + r, (root.l << r) + branches, idx);
+        coord_t skip = idx + pow2(levels - r) - 1;
+        if( idx + 1 < end )
+            visitor.prefetch(idx + 1);
+        if( skip < end )
+            visitor.prefetch(skip);
+        visited++;
+        bool expand = visitor.visit(node);
+        if( !expand )
+            leaves++;
+        else if( r == tile_height - 1 ){
+            frontier_entries++;
+            visitor.frontier(node);
+            expand = false;
+        }
+        if( expand && r + 1 < levels ){
+            r++;
+            branches = branches << 1;
+            idx = idx + 1;
+            continue;
+        }
+        // Past this subtree: climb out of the right children it ends, finishing their parents.
+        idx = skip;
+        while( r > 0 && (branches & 1) ){
+            r--;
+            branches = branches >> 1;
+            if( Visitor::post_order )
+                visitor.leave(path[r], path[r+1]);
+        }
+        if( r == 0 )
+            break;
+        branches = branches | 1;
+    }
+    if( current_counters == NULL )
+        return;
+    int level = min(tile_root / tile_height, MAX_TILE_LEVELS - 1);
+    current_counters->node_visits += visited;
+    current_counters->leaves += leaves;
+    current_counters->tiles++;
+    current_counters->tile_slots += pow2(levels) - 1;
+    current_counters->frontier_entries += frontier_entries;
+    if( tile_root + levels <= max_depth )
+        current_counters->frontier_slots += pow2(levels - 1);
+    current_counters->level_visits[level] += visited;
+    current_counters->level_us[level] += Realm::Clock::current_time_in_microseconds() - start_us;
+}
+
+// The common tile heights are walked with the height fixed at compile time.
+template<typename Visitor>
+void walk_tile(int max_depth, int tile_height, const FrontierEntry &root, Visitor &visitor){
+    switch( tile_height ){
+        case 2: scan_tile(TileIndex<2>(), max_depth, root, visitor); break;
+        case 3: scan_tile(TileIndex<3>(), max_depth, root, visitor); break;
+        case 4: scan_tile(TileIndex<4>(), max_depth, root, visitor); break;
+        case 8: scan_tile(TileIndex<8>(), max_depth, root, visitor); break;
+        default: scan_tile(RuntimeTileIndex(tile_height), max_depth, root, visitor); break;
+    }
+}
+
+// Visitors that only walk down the tile.
+struct PreOrderVisitor{
+    static const bool post_order = false;
+    void leave(const FrontierEntry &node, const FrontierEntry &right) {}
+    void prefetch(coord_t idx) const {}
+};
+
+// Prefetch of the coefficients of a node the walk is about to visit.
+template<typename Accessor>
+inline void prefetch_coeffs(const Accessor &coeffs, coord_t idx){
+    __builtin_prefetch(coeffs.ptr(idx));
+}
+
+// Collects the frontier from the leaf flags alone, for walks that need only the structure.
+struct StructureVisitor : public PreOrderVisitor{
+    const FieldAccessor<READ_ONLY,bool,1,coord_t,Realm::AffineAccessor<bool,1,coord_t> > &is_leaf;
+    Frontier &result;
+    StructureVisitor( const FieldAccessor<READ_ONLY,bool,1,coord_t,Realm::AffineAccessor<bool,1,coord_t> > &_is_leaf, Frontier &_result ) : is_leaf(_is_leaf), result(_result) {}
+    bool visit(FrontierEntry &node){
+        return !is_leaf[node.idx];
+    }
+    void frontier(const FrontierEntry &node){
+        result.entries.push_back(node);
+    }
+};
+
+// Slots of a tile block that hold no node keep value 0 and a set leaf flag, so whole blocks
+// can be compared and streamed by the leaf kernels.
+template<typename Accessor>
+void clear_tile_block(const Accessor &tree_acc, coord_t idx, coord_t extent){
+    Rect<1> block(idx, idx + extent - 1);
+    memset(tree_acc.coeffs.ptr(block), 0, extent * sizeof(Coefficients));
+    bool *is_leaf = tree_acc.is_leaf.ptr(block);
+    for( coord_t i = 0 ; i < extent ; i++ )
+        is_leaf[i] = true;
+}
+
+// Entry of a tile in a tree plan. Tiles are numbered level by level and left to right within a
+// level, so the child tiles of a tile are the children entries from first_child on. In a plan
+// merged from several trees, bit i of operands is set when tree i has the tile.
+struct TilePlan{
+    int n;
+    coord_t l;
+    coord_t idx;
+    coord_t first_child;
+    int children;
+    unsigned operands;
+    TilePlan() : n(0), l(0), idx(0), first_child(0), children(0), operands(0) {}
+    TilePlan( int _n, coord_t _l, coord_t _idx ) : n(_n), l(_l), idx(_idx), first_child(0), children(0), operands(0) {}
+};
+
+// Launch plan of a tree: its tiles level by level, which the top level keeps to size one index
+// launch per level, and which Legion keeps in the plan region, where a tile task reads its own
+// entry through a region requirement. Level k of the region is split into one entry per tile
+// and level k+1 into the child tiles of each tile of level k, so that the tasks of a level can
+// hand data down (or up) to the next one; blocks[k] splits the tree by the tiles of level k. A
+// plan is good until the structure of its tree changes: refine, restore and gaxpy make a new
+// one, every other operator launches from it.
+struct TreePlan{
+    LogicalRegion tree;     // NO_REGION for a plan merged from several trees
+    Arguments args;         // of the root tile
+    vector<TilePlan> tiles;
+    vector<coord_t> level_start;    // level k holds tiles level_start[k] to level_start[k+1]-1
+    LogicalRegion region;
+    LogicalPartition levels;
+    vector<LogicalPartition> entries;
+    vector<LogicalPartition> children;
+    vector<LogicalPartition> blocks;
+    TreePlan() : tree(LogicalRegion::NO_REGION), args(0, 0, 0, 0, 0), region(LogicalRegion::NO_REGION) {}
+    int num_levels() const {
+        return static_cast<int>(level_start.size()) - 1;
+    }
+    Rect<1> level(int k) const {
+        return Rect<1>(level_start[k], level_start[k+1] - 1);
+    }
+};
+
+unsigned all_operands(size_t count){
+    return count >= 32 ? ~0u : (1u << count) - 1;
+}
+
+// Partition of tree coloring tile t of level k of plan with its block. With a mask, the tiles
+// that have none of its operand bits get an empty block instead.
+LogicalPartition create_block_partition(HighLevelRuntime *runtime, Context ctx, LogicalRegion tree, const TreePlan &plan, int k, unsigned mask){
+    DomainPointColoring coloring;
+    for( coord_t t = plan.level_start[k] ; t < plan.level_start[k+1] ; t++ ){
+        const TilePlan &tile = plan.tiles[t];
+        coord_t extent = mask == 0 || (tile.operands & mask) ? tile_extent(plan.args.max_depth, tile.n, plan.args.tile_height) : 0;
+        coloring[t] = Rect<1>(tile.idx, tile.idx + extent - 1);
+    }
+    IndexPartition ip = runtime->create_index_partition(ctx, tree.get_index_space(), plan.level(k), coloring, DISJOINT_KIND);
+    return runtime->get_logical_partition(ctx, tree, ip);
+}
+
+vector<LogicalPartition> create_block_partitions(HighLevelRuntime *runtime, Context ctx, LogicalRegion tree, const TreePlan &plan, unsigned mask){
+    vector<LogicalPartition> blocks;
+    for( int k = 0 ; k < plan.num_levels() ; k++ )
+        blocks.push_back(create_block_partition(runtime, ctx, tree, plan, k, mask));
+    return blocks;
+}
+
+void destroy_block_partitions(HighLevelRuntime *runtime, Context ctx, const vector<LogicalPartition> &blocks){
+    for( size_t k = 0 ; k < blocks.size() ; k++ )
+        runtime->destroy_index_partition(ctx, blocks[k].get_index_partition());
+}
+
+// Makes the plan region of plan, with a pass field for each of passes operands, and its
+// partitions, and writes the entries with one inline mapping of the whole region.
+void create_plan_region(HighLevelRuntime *runtime, Context ctx, TreePlan &plan, int passes = 1){
+    IndexSpace is = runtime->create_index_space(ctx, Rect<1>(0, static_cast<coord_t>(plan.tiles.size()) - 1));
+    FieldSpace fs = runtime->create_field_space(ctx);
+    {
+        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
+        allocator.allocate_field(sizeof(TilePlan), FID_TILE);
+        allocator.allocate_field(sizeof(Coefficients), FID_TILE_VALUE);
+        for( int k = 0 ; k < passes ; k++ )
+            allocator.allocate_field(sizeof(FrontierPass), FID_TILE_PASS + k);
+    }
+    plan.region = runtime->create_logical_region(ctx, is, fs);
+    int num_levels = plan.num_levels();
+    DomainPointColoring level_coloring;
+    for( int k = 0 ; k < num_levels ; k++ )
+        level_coloring[k] = plan.level(k);
+    IndexPartition level_ip = runtime->create_index_partition(ctx, is, Rect<1>(0, num_levels - 1), level_coloring, DISJOINT_KIND);
+    plan.levels = runtime->get_logical_partition(ctx, plan.region, level_ip);
+    for( int k = 0 ; k < num_levels ; k++ ){
+        LogicalRegion level = runtime->get_logical_subregion_by_color(ctx, plan.levels, k);
+        DomainPointColoring entry_coloring, child_coloring;
+        for( coord_t t = plan.level_start[k] ; t < plan.level_start[k+1] ; t++ ){
+            entry_coloring[t] = Rect<1>(t, t);
+            child_coloring[t] = Rect<1>(plan.tiles[t].first_child, plan.tiles[t].first_child + plan.tiles[t].children - 1);
+        }
+        IndexPartition entry_ip = runtime->create_index_partition(ctx, level.get_index_space(), plan.level(k), entry_coloring, DISJOINT_KIND);
+        plan.entries.push_back(runtime->get_logical_partition(ctx, level, entry_ip));
+        if( k + 1 == num_levels )
+            break;
+        LogicalRegion below = runtime->get_logical_subregion_by_color(ctx, plan.levels, k + 1);
+        IndexPartition child_ip = runtime->create_index_partition(ctx, below.get_index_space(), plan.level(k), child_coloring, DISJOINT_KIND);
+        plan.children.push_back(runtime->get_logical_partition(ctx, below, child_ip));
+    }
+    RegionRequirement req(plan.region, WRITE_DISCARD, EXCLUSIVE, plan.region);
+    req.add_field(FID_TILE);
+    PhysicalRegion region = runtime->map_region( ctx, req );
+    const FieldAccessor<WRITE_DISCARD,TilePlan,1,coord_t,Realm::AffineAccessor<TilePlan,1,coord_t> > tiles(region, FID_TILE);
+    for( size_t t = 0 ; t < plan.tiles.size() ; t++ )
+        tiles[t] = plan.tiles[t];
+    runtime->unmap_region( ctx, region );
+}
+
+// Destroy the plan before its tree, whose index space holds the block partitions.
+void destroy_tree_plan(HighLevelRuntime *runtime, Context ctx, TreePlan &plan){
+    destroy_block_partitions(runtime, ctx, plan.blocks);
+    runtime->destroy_logical_region(ctx, plan.region);
+    runtime->destroy_field_space(ctx, plan.region.get_field_space());
+    runtime->destroy_index_space(ctx, plan.region.get_index_space());
+    plan = TreePlan();
+}
+
+Arguments tile_arguments(const TreePlan &plan, const TilePlan &tile){
+    Arguments args = plan.args;
+    args.n = tile.n;
+    args.l = tile.l;
+    args.idx = tile.idx;
+    return args;
+}
+
+// Sets the child tiles of tile t, at positions, as the next tiles of the level below it.
+void add_child_tiles(TreePlan &plan, coord_t t, const vector<int> &positions){
+    TilePlan parent = plan.tiles[t];
+    plan.tiles[t].first_child = plan.tiles.size();
+    plan.tiles[t].children = positions.size();
+    for( size_t i = 0 ; i < positions.size() ; i++ )
+        plan.tiles.push_back(TilePlan(parent.n + plan.args.tile_height, (parent.l << plan.args.tile_height) + positions[i], child_tile_idx(plan.args.max_depth, parent.n, parent.idx, plan.args.tile_height, positions[i])));
+}
+
+// Closes the level that the tiles added since the last one make, if any.
+void close_level(TreePlan &plan){
+    if( static_cast<coord_t>(plan.tiles.size()) > plan.level_start.back() )
+        plan.level_start.push_back(plan.tiles.size());
+}
+
+// Child tiles of one tile for build_tree_plan, as the frontier of its block.
+Frontier plan_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
+    : *(const Arguments *) task->args;
+    TaskProbe probe(runtime, ctx, task->task_id);
+    Frontier frontier;
+    const FieldAccessor<READ_ONLY,bool,1,coord_t,Realm::AffineAccessor<bool,1,coord_t> > is_leaf(regions[0], FID_IS_LEAF);
+    StructureVisitor visitor(is_leaf, frontier);
+    walk_tile(args.max_depth, args.tile_height, FrontierEntry(args.n, args.l, args.idx), visitor);
+    return frontier;
+}
+
+// Plan of the tree in lr, gathered level by level from the leaf flags of its blocks. The top
+// level waits for every level before it can launch the next one, so the plan is made once per
+// change of structure rather than by every operator.
+TreePlan build_tree_plan(HighLevelRuntime *runtime, Context ctx, LogicalRegion lr, const Arguments &args){
+    TreePlan plan;
+    plan.tree = lr;
+    plan.args = args;
+    plan.tiles.push_back(TilePlan(args.n, args.l, args.idx));
+    plan.level_start.push_back(0);
+    close_level(plan);
+    for( int k = 0 ; k < plan.num_levels() ; k++ ){
+        plan.blocks.push_back(create_block_partition(runtime, ctx, lr, plan, k, 0));
+        ArgumentMap arg_map;
+        for( coord_t t = plan.level_start[k] ; t < plan.level_start[k+1] ; t++ ){
+            Arguments tile_args = tile_arguments(plan, plan.tiles[t]);
+            arg_map.set_point( t, TaskArgument(&tile_args, sizeof(Arguments)));
+        }
+        IndexTaskLauncher plan_launcher(PLAN_TASK_ID, Domain(plan.level(k)), TaskArgument(NULL, 0), arg_map);
+        plan_launcher.tag = TILE_LEVEL_TAG;
+        count_launch(plan.level(k).volume());
+        plan_launcher.add_region_requirement(RegionRequirement(plan.blocks[k], 0, READ_ONLY, EXCLUSIVE, lr));
+        plan_launcher.add_field(0, FID_IS_LEAF);
+        FutureMap frontiers = runtime->execute_index_space(ctx, plan_launcher);
+        for( coord_t t = plan.level_start[k] ; t < plan.level_start[k+1] ; t++ )
+            add_child_tiles(plan, t, frontier_positions(frontiers.get_result<Frontier>(t), plan.tiles[t].n));
+        close_level(plan);
+    }
+    create_plan_region(runtime, ctx, plan);
+    return plan;
+}
+
+// Merges plans level by level from the root. A tile is kept when every plan has it (every) or
+// when any plan does, and bit i of its operands tells whether plans[i] has it. The merged plan
+// is what an inner product or gaxpy walks; it has no tree and no plan region of its own.
+TreePlan merge_plans(const vector<const TreePlan *> &plans, bool every){
+    size_t count = plans.size();
+    TreePlan merged;
+    merged.args = plans[0]->args;
+    merged.tiles.push_back(plans[0]->tiles[0]);
+    merged.tiles[0].operands = all_operands(count);
+    merged.level_start.push_back(0);
+    close_level(merged);
+    // Tile number in every plan of each merged tile, -1 where that plan lacks it.
+    vector<vector<coord_t> > source(1, vector<coord_t>(count, 0));
+    for( int k = 0 ; k < merged.num_levels() ; k++ ){
+        for( coord_t t = merged.level_start[k] ; t < merged.level_start[k+1] ; t++ ){
+            // Child tiles of every plan as (l, plan, tile), sorted so equal tiles are adjacent.
+            vector<pair<coord_t, pair<size_t, coord_t> > > found;
+            for( size_t i = 0 ; i < count ; i++ ){
+                coord_t s = source[t][i];
+                if( s < 0 )
+                    continue;
+                const TilePlan &tile = plans[i]->tiles[s];
+                for( coord_t c = tile.first_child ; c < tile.first_child + tile.children ; c++ )
+                    found.push_back(make_pair(plans[i]->tiles[c].l, make_pair(i, c)));
+            }
+            sort(found.begin(), found.end());
+            merged.tiles[t].first_child = merged.tiles.size();
+            for( size_t first = 0 ; first < found.size() ; ){
+                size_t last = first;
+                vector<coord_t> from(count, -1);
+                unsigned operands = 0;
+                for( ; last < found.size() && found[last].first == found[first].first ; last++ ){
+                    from[found[last].second.first] = found[last].second.second;
+                    operands |= 1u << found[last].second.first;
+                }
+                if( !every || operands == all_operands(count) ){
+                    TilePlan child = plans[found[first].second.first]->tiles[found[first].second.second];
+                    child.first_child = 0;
+                    child.children = 0;
+                    child.operands = operands;
+                    merged.tiles.push_back(child);
+                    source.push_back(from);
+                }
+                first = last;
+            }
+            merged.tiles[t].children = merged.tiles.size() - merged.tiles[t].first_child;
+        }
+        close_level(merged);
+    }
+    return merged;
+}
+
+// Index launch of task_id over level k of plan. Point t gets the block of tile t in the tree of
+// the plan with privilege (requirement 0) and its plan entry (requirement 1); callers add what
+// else their task needs.
+IndexTaskLauncher plan_launcher(TaskID task_id, const TreePlan &plan, int k, PrivilegeMode privilege){
+    IndexTaskLauncher launcher(task_id, Domain(plan.level(k)), TaskArgument(&plan.args, sizeof(Arguments)), ArgumentMap());
+    launcher.tag = TILE_LEVEL_TAG;
+    count_launch(plan.level(k).volume());
+    launcher.add_region_requirement(RegionRequirement(plan.blocks[k], 0, privilege, EXCLUSIVE, plan.tree));
+    launcher.add_field(0, FID_COEFFS);
+    launcher.add_field(0, FID_IS_LEAF);
+    launcher.add_region_requirement(RegionRequirement(plan.entries[k], 0, READ_ONLY, EXCLUSIVE, plan.region));
+    launcher.add_field(1, FID_TILE);
+    return launcher;
+}
+
+TilePlan plan_entry(const Task *task, const PhysicalRegion &entry){
+    const FieldAccessor<READ_ONLY,TilePlan,1,coord_t,Realm::AffineAccessor<TilePlan,1,coord_t> > tiles(entry, FID_TILE);
+    return tiles[task->index_point[0]];
+}
+
+// Arguments of the tile of a plan launch point: the root arguments of the launch with the
+// position read from the tile's plan entry.
+Arguments plan_arguments(const Task *task, const PhysicalRegion &entry){
+    Arguments args = *(const Arguments *) task->args;
+    TilePlan tile = plan_entry(task, entry);
+    args.n = tile.n;
+    args.l = tile.l;
+    args.idx = tile.idx;
+    return args;
+}
+
+// Pass in field of the tile of a plan launch point, left in its entry by its parent tile. The
+// root tile has no parent and starts from an empty pass.
+FrontierPass plan_pass(const Task *task, const PhysicalRegion &entry, FieldID field){
+    if( task->index_point[0] == 0 )
+        return FrontierPass();
+    const FieldAccessor<READ_ONLY,FrontierPass,1,coord_t,Realm::AffineAccessor<FrontierPass,1,coord_t> > passes(entry, field);
+    return passes[task->index_point[0]];
+}
+
+// Hands the pass of every frontier node of tile down to the two child tiles below it, which
+// follow the frontier in the plan.
+void write_child_passes(const PhysicalRegion &children, FieldID field, const TilePlan &tile, const Frontier &frontier){
+    if( tile.children == 0 )
+        return;
+    assert( 2 * static_cast<coord_t>(frontier.passes.size()) == tile.children );
+    const FieldAccessor<WRITE_DISCARD,FrontierPass,1,coord_t,Realm::AffineAccessor<FrontierPass,1,coord_t> > passes(children, field);
+    for( int c = 0 ; c < tile.children ; c++ )
+        passes[tile.first_child + c] = frontier.passes[c / 2];
+}
+
+// Requirement on the children entries of the tiles of level k, for the tasks of that level to
+// write privilege into field.
+RegionRequirement children_requirement(const TreePlan &plan, int k, PrivilegeMode privilege, FieldID field){
+    RegionRequirement req(plan.children[k], 0, privilege, EXCLUSIVE, plan.region);
+    req.add_field(field);
+    return req;
+}
+
+// Dump tasks append their tile records to the buffer of their processor's slot. A buffer that
+// fills up goes to the file in one pwrite at an offset reserved with an atomic add, so tiles
+// stream out in parallel, in large writes and without a lock. dump_tree flushes the rest.
+const size_t DUMP_BUFFER_SIZE = 1 << 22;
+
+vector<char> dump_buffers[MAX_COUNTER_SLOTS];
+int dump_fd = -1;
+std::atomic<long long> dump_offset;
+
+void flush_dump_buffer(vector<char> &buffer){
+    if( buffer.empty() )
+        return;
+    long long offset = dump_offset.fetch_add(buffer.size());
+    ssize_t written = pwrite(dump_fd, &buffer[0], buffer.size(), offset);
+    assert( written == static_cast<ssize_t>(buffer.size()) );
+    buffer.clear();
+}
+
+struct DumpVisitor : public PreOrderVisitor{
+    const TreeAccessor<READ_ONLY,READ_ONLY> &read_acc;
+    int node_count;
+    vector<unsigned char> bitmap;
+    vector<double> values;
+    DumpVisitor( const TreeAccessor<READ_ONLY,READ_ONLY> &_read_acc, coord_t extent ) : read_acc(_read_acc), node_count(0), bitmap(tile_bitmap_bytes(extent), 0) {
+        values.reserve(extent * NUM_COEFFS);
+    }
+    void prefetch(coord_t idx) const {
+        prefetch_coeffs(read_acc.coeffs, idx);
+    }
+    bool visit(FrontierEntry &node){
+        bool interior = !read_acc.is_leaf[node.idx];
+        if( interior )
+            bitmap[node_count / 8] |= 1 << (node_count % 8);
+        node_count++;
+        values.insert(values.end(), read_acc.coeffs[node.idx].c, read_acc.coeffs[node.idx].c + NUM_COEFFS);
+        return interior;
+    }
+    void frontier(const FrontierEntry &node) {}
+};
+
+void append_tile_record(int slot, const Arguments &args, const DumpVisitor &visitor){
+    vector<char> &buffer = dump_buffers[slot];
+    if( buffer.capacity() < DUMP_BUFFER_SIZE )
+        buffer.reserve(DUMP_BUFFER_SIZE);
+    TileRecordHeader header;
+    header.n = args.n;
+    header.node_count = visitor.node_count;
+    header.l = args.l;
+    header.idx = args.idx;
+    const char *bits = reinterpret_cast<const char *>(&visitor.bitmap[0]);
+    const char *values = reinterpret_cast<const char *>(&visitor.values[0]);
+    buffer.insert(buffer.end(), reinterpret_cast<const char *>(&header), reinterpret_cast<const char *>(&header + 1));
+    buffer.insert(buffer.end(), bits, bits + tile_bitmap_bytes(visitor.node_count));
+    buffer.insert(buffer.end(), values, values + visitor.values.size() * sizeof(double));
+    if( buffer.size() >= DUMP_BUFFER_SIZE )
+        flush_dump_buffer(buffer);
+}
+
+void dump_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    Arguments args = plan_arguments(task, regions[1]);
+    TaskProbe probe(runtime, ctx, task->task_id);
+    const TreeAccessor<READ_ONLY,READ_ONLY> tree_acc(regions[0]);
+    DumpVisitor visitor(tree_acc, tile_extent(args.max_depth, args.n, args.tile_height));
+    walk_tile(args.max_depth, args.tile_height, FrontierEntry(args.n, args.l, args.idx), visitor);
+    append_tile_record(probe.slot, args, visitor);
+}
+
+// Writes the tree of plan to path in the format of tree_dump.h; tree_dump_text turns it into the
+// old text listing. Every level is one index launch, and the tiles of this process are flushed
+// once every dump task is done.
+bool dump_tree(HighLevelRuntime *runtime, Context ctx, const TreePlan &plan, const char *path){
+    dump_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if( dump_fd < 0 ){
+        cout<<"Cannot open "<<path<<" for the tree dump"<<endl;
+        return false;
+    }
+    TreeDumpHeader header;
+    memcpy(header.magic, TREE_DUMP_MAGIC, sizeof(header.magic));
+    header.num_coeffs = NUM_COEFFS;
+    header.max_depth = plan.args.max_depth;
+    header.tile_height = plan.args.tile_height;
+    header.reserved = 0;
+    ssize_t written = pwrite(dump_fd, &header, sizeof(header), 0);
+    assert( written == sizeof(header) );
+    dump_offset = sizeof(header);
+    for( int k = 0 ; k < plan.num_levels() ; k++ )
+        runtime->execute_index_space(ctx, plan_launcher(DUMP_TASK_ID, plan, k, READ_ONLY));
+    runtime->issue_execution_fence(ctx).get_void_result();
+    for( size_t i = 0 ; i < counter_slot_of.size() ; i++ )
+        flush_dump_buffer(dump_buffers[i]);
+    close(dump_fd);
+    dump_fd = -1;
+    return true;
+}
+
+// Checkpoints are tree dumps, so a checkpoint holds the live tile blocks only and its size
+// follows the tree rather than its index space. Loading makes the plan of the tree from the
+// record headers alone and restores it one index launch per level; each restore task reads its
+// record from the mapped checkpoint.
+bool save_tree(HighLevelRuntime *runtime, Context ctx, const TreePlan &plan, const char *path){
+    return dump_tree(runtime, ctx, plan, path);
+}
+
+// Replays a tile record in the order it was written: bit i tells whether the i-th visited node
+// has children.
+struct RecordVisitor : public PreOrderVisitor{
+    const unsigned char *bitmap;
+    const char *values;
+    const TreeAccessor<WRITE_DISCARD,WRITE_DISCARD> &tree_acc;
+    Frontier &result;
+    int node_count;
+    RecordVisitor( const char *record, const TreeAccessor<WRITE_DISCARD,WRITE_DISCARD> &_tree_acc, Frontier &_result ) : tree_acc(_tree_acc), result(_result), node_count(0) {
+        TileRecordHeader header;
+        memcpy(&header, record, sizeof(header));
+        bitmap = reinterpret_cast<const unsigned char *>(record + sizeof(header));
+        values = record + sizeof(header) + tile_bitmap_bytes(header.node_count);
+    }
+    bool visit(FrontierEntry &node){
+        bool interior = tile_bit(bitmap, node_count);
+        memcpy(tree_acc.coeffs[node.idx].c, values + node_count * sizeof(Coefficients), sizeof(Coefficients));
+        tree_acc.is_leaf[node.idx] = !interior;
+        node_count++;
+        return interior;
+    }
+    void frontier(const FrontierEntry &node){
+        result.entries.push_back(node);
+    }
+};
+
+// The checkpoint being loaded, mapped once by load_tree; restore tasks run in this process and
+// read their records from it by offset.
+const char *restore_base = NULL;
+
+// One tile of a restore level launch (see load_tree): fills the tile block from the record at
+// the offset in the point argument. Returns false when the record is not the tile's, or does not
+// have the node count or the child tiles that the headers gave the plan.
+bool restore_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    Arguments args = plan_arguments(task, regions[1]);
+    TaskProbe probe(runtime, ctx, task->task_id);
+    TilePlan tile = plan_entry(task, regions[1]);
+    const char *record = restore_base + *(const size_t *) task->local_args;
+    TileRecordHeader header;
+    memcpy(&header, record, sizeof(header));
+    const TreeAccessor<WRITE_DISCARD,WRITE_DISCARD> tree_acc(regions[0]);
+    clear_tile_block(tree_acc, args.idx, tile_extent(args.max_depth, args.n, args.tile_height));
+    Frontier frontier;
+    RecordVisitor visitor(record, tree_acc, frontier);
+    walk_tile(args.max_depth, args.tile_height, FrontierEntry(args.n, args.l, args.idx), visitor);
+    return header.l == args.l && header.idx == args.idx && visitor.node_count == header.node_count
+        && static_cast<int>(2 * frontier.entries.size()) == tile.children;
+}
+
+// Where a tile record sits in a checkpoint.
+struct RecordPosition{
+    coord_t l;
+    size_t offset;
+    bool operator<(const RecordPosition &other) const {
+        return l < other.l;
+    }
+};
+
+// Plan of the tree with records sorted level by level, left to right, taking the root tile from
+// plan.args. offsets gets the record of each tile. Returns false when a record has no parent
+// tile, repeats a tile or sits where no child tile can.
+bool plan_from_records(TreePlan &plan, vector<vector<RecordPosition> > &levels, vector<size_t> &offsets){
+    if( levels.empty() || levels[0].size() != 1 || levels[0][0].l != plan.args.l )
+        return false;
+    plan.tiles.push_back(TilePlan(plan.args.n, plan.args.l, plan.args.idx));
+    plan.level_start.push_back(0);
+    offsets.push_back(levels[0][0].offset);
+    close_level(plan);
+    int tile_height = plan.args.tile_height;
+    for( size_t k = 0 ; k + 1 < levels.size() ; k++ ){
+        const vector<RecordPosition> &below = levels[k+1];
+        size_t c = 0;
+        for( coord_t t = plan.level_start[k] ; t < plan.level_start[k+1] ; t++ ){
+            vector<int> positions;
+            for( ; c < below.size() && (below[c].l >> tile_height) == plan.tiles[t].l ; c++ ){
+                int position = static_cast<int>(below[c].l - (plan.tiles[t].l << tile_height));
+                if( !positions.empty() && positions.back() == position )
+                    return false;
+                positions.push_back(position);
+                offsets.push_back(below[c].offset);
+            }
+            add_child_tiles(plan, t, positions);
+        }
+        if( c != below.size() )
+            return false;
+        close_level(plan);
+    }
+    return true;
+}
+
+// Loads a checkpoint written by save_tree into lr, a fresh region of the same extent, and makes
+// plan its plan. One pass over the record headers places the records in the plan; then every
+// level is one restore launch, each point given the offset of its record.
+bool load_tree(HighLevelRuntime *runtime, Context ctx, LogicalRegion lr, const Arguments &args, const char *path, TreePlan &plan){
+    int fd = open(path, O_RDONLY);
+    struct stat file_stat;
+    if( fd < 0 || fstat(fd, &file_stat) != 0 ){
+        cout<<"Cannot read checkpoint "<<path<<endl;
+        if( fd >= 0 )
+            close(fd);
+        return false;
+    }
+    size_t bytes = file_stat.st_size;
+    char *base = bytes < sizeof(TreeDumpHeader) ? static_cast<char *>(MAP_FAILED)
+        : static_cast<char *>(mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0));
+    close(fd);
+    if( base == MAP_FAILED ){
+        cout<<"Cannot map checkpoint "<<path<<endl;
+        return false;
+    }
+    TreeDumpHeader header;
+    memcpy(&header, base, sizeof(header));
+    if( memcmp(header.magic, TREE_DUMP_MAGIC, sizeof(header.magic)) != 0 || header.num_coeffs != NUM_COEFFS
+        || header.max_depth != args.max_depth || header.tile_height != args.tile_height ){
+        cout<<"Checkpoint "<<path<<" does not match -max_depth, --tile or NUM_COEFFS"<<endl;
+        munmap(base, bytes);
+        return false;
+    }
+    int tile_height = args.tile_height;
+    bool complete = true;
+    vector<vector<RecordPosition> > levels;
+    size_t offset = sizeof(header);
+    while( complete && offset < bytes ){
+        TileRecordHeader record;
+        complete = offset + sizeof(record) <= bytes;
+        if( !complete )
+            break;
+        memcpy(&record, base + offset, sizeof(record));
+        complete = record.n >= args.n && (record.n - args.n) % tile_height == 0 && record.n < args.max_depth
+            && record.node_count > 0 && offset + tile_record_bytes(record.node_count, NUM_COEFFS) <= bytes;
+        if( !complete )
+            break;
+        size_t k = (record.n - args.n) / tile_height;
+        if( levels.size() <= k )
+            levels.resize(k + 1);
+        RecordPosition position = { record.l, offset };
+        levels[k].push_back(position);
+        offset += tile_record_bytes(record.node_count, NUM_COEFFS);
+    }
+    for( size_t k = 0 ; k < levels.size() ; k++ )
+        std::sort(levels[k].begin(), levels[k].end());
+    plan = TreePlan();
+    plan.tree = lr;
+    plan.args = args;
+    vector<size_t> offsets;
+    complete = complete && plan_from_records(plan, levels, offsets);
+    if( !complete ){
+        cout<<"Checkpoint "<<path<<" is missing a tile or holds a damaged one"<<endl;
+        munmap(base, bytes);
+        plan = TreePlan();
+        return false;
+    }
+    create_plan_region(runtime, ctx, plan);
+    plan.blocks = create_block_partitions(runtime, ctx, lr, plan, 0);
+    restore_base = base;
+    vector<FutureMap> restored;
+    for( int k = 0 ; k < plan.num_levels() ; k++ ){
+        IndexTaskLauncher restore_launcher = plan_launcher(RESTORE_TASK_ID, plan, k, WRITE_DISCARD);
+        for( coord_t t = plan.level_start[k] ; t < plan.level_start[k+1] ; t++ )
+            restore_launcher.argument_map.set_point(t, TaskArgument(&offsets[t], sizeof(size_t)));
+        restored.push_back(runtime->execute_index_space(ctx, restore_launcher));
+    }
+    for( int k = 0 ; k < plan.num_levels() ; k++ )
+        for( coord_t t = plan.level_start[k] ; t < plan.level_start[k+1] ; t++ )
+            complete = restored[k].get_result<bool>(t) && complete;
+    restore_base = NULL;
+    munmap(base, bytes);
+    if( !complete ){
+        cout<<"Checkpoint "<<path<<" is missing a tile or holds a damaged one"<<endl;
+        destroy_tree_plan(runtime, ctx, plan);
+    }
+    return complete;
+}
+
+// Compresses the tree of plan, one index launch per level from the bottom up, so that a tile
+// runs once the tiles below it have left their root values in the plan region. The sum of
+// squares of every node goes into slot 0 of sum, unless sum is NO_REGION.
+void tree_compress(HighLevelRuntime *runtime, Context ctx, const TreePlan &plan, LogicalRegion sum){
+    for( int k = plan.num_levels() - 1 ; k >= 0 ; k-- ){
+        IndexTaskLauncher compress_launcher = plan_launcher(COMPRESS_TASK_ID, plan, k, READ_WRITE);
+        compress_launcher.add_region_requirement(RegionRequirement(plan.entries[k], 0, WRITE_DISCARD, EXCLUSIVE, plan.region));
+        compress_launcher.add_field(2, FID_TILE_VALUE);
+        if( k + 1 < plan.num_levels() )
+            compress_launcher.add_region_requirement(children_requirement(plan, k, READ_ONLY, FID_TILE_VALUE));
+        if( sum != LogicalRegion::NO_REGION )
+            compress_launcher.add_region_requirement(sum_requirement(sum));
+        runtime->execute_index_space(ctx, compress_launcher);
+    }
+}
+
+// A tree region spans every node down to max_depth, far more than a tree ever holds. That is
+// affordable only through TileMapper::block_instance: tasks and inline mappings name tile blocks
+// alone, each block gets an instance of its own extent, and no path maps a whole tree.
+LogicalRegion create_tree_region(HighLevelRuntime *runtime, Context ctx, FieldSpace fs, int max_depth){
+    IndexSpace tree_is = runtime->create_index_space(ctx, Rect<1>(0LL, subtree_extent(max_depth, 0) - 1));
+    return runtime->create_logical_region(ctx, tree_is, fs);
+}
+
+void destroy_tree_region(HighLevelRuntime *runtime, Context ctx, LogicalRegion lr){
+    IndexSpace tree_is = lr.get_index_space();
+    runtime->destroy_logical_region(ctx, lr);
+    runtime->destroy_index_space(ctx, tree_is);
+}
+
+// Times a trial refine followed by compress on a scratch tree for each candidate tile height
+// and returns the fastest. Tile height trades task count against work per task, which depends
+// on depth, sparsity and the machine, so it is measured rather than guessed.
+int autotune_tile_height(HighLevelRuntime *runtime, Context ctx, FieldSpace fs, int max_depth, int actual_left_depth, int trials, coord_t grain, double refine_prob){
+    int best_height = 1;
+    long long best_time = -1;
+    int max_height = min(min(8, max_depth), MAX_TILE_HEIGHT);
+    for( int height = 2 ; height <= max_height ; height++ ){
+        long long height_time = -1;
+        for( int trial = 0 ; trial < trials ; trial++ ){
+            // A fresh index space per trial, since refine registers its tile partitions on it.
+            LogicalRegion scratch = create_tree_region(runtime, ctx, fs, max_depth);
+            Arguments args(0, 0, max_depth, 0, 1, actual_left_depth, height);
+            args.grain = grain;
+            args.refine_prob = refine_prob;
+            long long start = Realm::Clock::current_time_in_microseconds();
+            TaskLauncher refine_launcher(REFINE_INTER_TASK_ID, TaskArgument(&args, sizeof(Arguments)));
+            refine_launcher.add_region_requirement(RegionRequirement(scratch, WRITE_DISCARD, EXCLUSIVE, scratch).add_flags(NO_ACCESS_FLAG));
+            refine_launcher.add_field(0, FID_COEFFS);
+            refine_launcher.add_field(0, FID_IS_LEAF);
+            runtime->execute_task(ctx, refine_launcher);
+            TreePlan plan = build_tree_plan(runtime, ctx, scratch, args);
+            tree_compress(runtime, ctx, plan, LogicalRegion::NO_REGION);
+            runtime->issue_execution_fence(ctx).get_void_result();
+            long long elapsed = Realm::Clock::current_time_in_microseconds() - start;
+            if( height_time < 0 || elapsed < height_time )
+                height_time = elapsed;
+            destroy_tree_plan(runtime, ctx, plan);
+            destroy_tree_region(runtime, ctx, scratch);
+        }
+        cout<<"Autotune: tile height "<<height<<" took "<<height_time<<" us"<<endl;
+        if( best_time < 0 || height_time < best_time ){
+            best_time = height_time;
+            best_height = height;
+        }
+    }
+    return best_height;
+}
+
+// Benchmark mode (--bench). Each repetition refines two fresh trees (or loads them from the
+// -load_trees checkpoints, timed as "load") and then runs norm,
+// inner product, gaxpy, compress and reconstruct, one at a time, with an execution fence closing
+// each. After the warmup repetitions, every operator gets one row with its best and mean wall
+// time, the tasks and node visits of one repetition and node visits per second. Rows are
+// appended to bench_out as CSV (a header is written into an empty file) or as JSON lines.
+// Tasks and node visits are summed over the processors of this process only. With -bench_batch
+// N, the same inner product and gaxpy are also run N times over as one batch of N tuples. A
+// checkpoint that fails to load ends the run early; the rows then cover the repetitions done.
+enum BenchOp{
+    BENCH_REFINE,
+    BENCH_LOAD,
+    BENCH_NORM,
+    BENCH_PRODUCT,
+    BENCH_GAXPY,
+    BENCH_COMPRESS,
+    BENCH_RECONSTRUCT,
+    BENCH_PRODUCT_BATCH,
+    BENCH_GAXPY_BATCH,
+    NUM_BENCH_OPS,
+};
+
+const char *bench_op_names[NUM_BENCH_OPS] = { "refine", "load", "norm", "inner_product", "gaxpy", "compress", "reconstruct", "inner_product_batch", "gaxpy_batch" };
+
+struct BenchConfig{
+    int warmup;
+    int reps;
+    bool json;
+    const char *out;
+    string load_prefix;     // load both trees from these checkpoints instead of refining them
+    int batch;              // tuples in the batched rows, none when 0
+    BenchConfig() : warmup(1), reps(5), json(false), out("bench.csv"), batch(0) {}
+};
+
+struct BenchStats{
+    long long best_us;
+    long long total_us;
+    long long tasks;
+    long long node_visits;
+    int reps;
+    BenchStats() : best_us(-1), total_us(0), tasks(0), node_visits(0), reps(0) {}
+};
+
+// Times everything issued since start, up to a fence, into stats when the repetition counts.
+struct BenchTimer{
+    long long start_us, start_tasks, start_visits;
+    BenchTimer() : start_us(Realm::Clock::current_time_in_microseconds()) {
+        ProcCounters counters = sum_counters();
+        start_tasks = counters.total_tasks();
+        start_visits = counters.node_visits;
+    }
+    void stop(HighLevelRuntime *runtime, Context ctx, bool timed, BenchStats &stats){
+        runtime->issue_execution_fence(ctx).get_void_result();
+        long long elapsed = Realm::Clock::current_time_in_microseconds() - start_us;
+        if( !timed )
+            return;
+        if( stats.best_us < 0 || elapsed < stats.best_us )
+            stats.best_us = elapsed;
+        stats.total_us = stats.total_us + elapsed;
+        stats.reps++;
+        ProcCounters counters = sum_counters();
+        stats.tasks = stats.tasks + (counters.total_tasks() - start_tasks);
+        stats.node_visits = stats.node_visits + (counters.node_visits - start_visits);
+    }
+};
+
+// Operands of the batched gaxpy (tree3 = alpha*tree1 + beta*tree2) and of the batched inner
+// product, named by the plans of their input trees. Outputs must be distinct from each other and
+// the inputs.
+struct GaxpyOperands{
+    const TreePlan *plan1, *plan2;
+    LogicalRegion tree3;
+    double alpha, beta;
+};
+
+struct ProductOperands{
+    const TreePlan *plan1, *plan2;
+};
+
+// Copy of plan whose operands say, for each tile, which operands of part have it: none where
+// part lacks the tile. Block partitions of the trees of part over the tiles of plan take it with
+// the operand bit of their tree as mask.
+TreePlan operands_of(const TreePlan &plan, const TreePlan &part){
+    std::map<pair<int, coord_t>, unsigned> operands;
+    for( size_t t = 0 ; t < part.tiles.size() ; t++ )
+        operands[make_pair(part.tiles[t].n, part.tiles[t].l)] = part.tiles[t].operands;
+    TreePlan view = plan;
+    for( size_t t = 0 ; t < view.tiles.size() ; t++ ){
+        std::map<pair<int, coord_t>, unsigned>::const_iterator found = operands.find(make_pair(view.tiles[t].n, view.tiles[t].l));
+        view.tiles[t].operands = found == operands.end() ? 0 : found->second;
+    }
+    return view;
+}
+
+// Gaxpy of the trees of plan1 and plan2 into tree3, which is tree1 itself in place, launched
+// from the union of their plans: the result has a tile wherever either operand has one. result
+// is the plan of tree3 from then on; blocks1 and blocks2 split the operands by its tiles, empty
+// where an operand lacks the tile (in place, tree1 is split by the result plan instead).
+struct GaxpyPlan{
+    TreePlan result;
+    LogicalRegion tree1, tree2;
+    vector<LogicalPartition> blocks1, blocks2;
+};
+
+GaxpyPlan create_gaxpy_plan(HighLevelRuntime *runtime, Context ctx, const TreePlan &plan1, const TreePlan &plan2, LogicalRegion tree3, const Arguments &args3){
+    vector<const TreePlan *> plans;
+    plans.push_back(&plan1);
+    plans.push_back(&plan2);
+    GaxpyPlan gaxpy;
+    gaxpy.result = merge_plans(plans, false);
+    gaxpy.result.tree = tree3;
+    gaxpy.result.args = args3;
+    gaxpy.result.blocks = create_block_partitions(runtime, ctx, tree3, gaxpy.result, 0);
+    create_plan_region(runtime, ctx, gaxpy.result);
+    gaxpy.tree1 = plan1.tree;
+    gaxpy.tree2 = plan2.tree;
+    if( !(tree3 == plan1.tree) )
+        gaxpy.blocks1 = create_block_partitions(runtime, ctx, plan1.tree, gaxpy.result, 1);
+    gaxpy.blocks2 = create_block_partitions(runtime, ctx, plan2.tree, gaxpy.result, 2);
+    return gaxpy;
+}
+
+// Drops the operand partitions of gaxpy, leaving its result as the plan of tree3.
+void destroy_gaxpy_operands(HighLevelRuntime *runtime, Context ctx, GaxpyPlan &gaxpy){
+    destroy_block_partitions(runtime, ctx, gaxpy.blocks1);
+    destroy_block_partitions(runtime, ctx, gaxpy.blocks2);
+    gaxpy.blocks1.clear();
+    gaxpy.blocks2.clear();
+}
+
+// tree3 = alpha*tree1 + beta*tree2, one index launch per level of the result from the root down:
+// the tiles of a level leave the pass and null flags of each child tile in its plan entry.
+void tree_gaxpy(HighLevelRuntime *runtime, Context ctx, const GaxpyPlan &gaxpy, double alpha, double beta){
+    const TreePlan &plan = gaxpy.result;
+    bool in_place = plan.tree == gaxpy.tree1;
+    GaxpyArgs args(plan.args.n, plan.args.l, plan.args.max_depth, plan.args.idx, Coefficients(), false, false, plan.args.actual_max_depth, plan.args.tile_height, alpha, beta, in_place);
+    for( int k = 0 ; k < plan.num_levels() ; k++ ){
+        IndexTaskLauncher gaxpy_launcher = plan_launcher(GAXPY_TASK_ID, plan, k, in_place ? READ_WRITE : WRITE_DISCARD);
+        gaxpy_launcher.global_arg = TaskArgument(&args, sizeof(GaxpyArgs));
+        gaxpy_launcher.add_field(1, FID_TILE_PASS);
+        if( !in_place ){
+            gaxpy_launcher.add_region_requirement(RegionRequirement(gaxpy.blocks1[k], 0, READ_ONLY, EXCLUSIVE, gaxpy.tree1));
+            gaxpy_launcher.add_field(2, FID_COEFFS);
+            gaxpy_launcher.add_field(2, FID_IS_LEAF);
+        }
+        unsigned r = in_place ? 2 : 3;
+        gaxpy_launcher.add_region_requirement(RegionRequirement(gaxpy.blocks2[k], 0, READ_ONLY, EXCLUSIVE, gaxpy.tree2));
+        gaxpy_launcher.add_field(r, FID_COEFFS);
+        gaxpy_launcher.add_field(r, FID_IS_LEAF);
+        if( k + 1 < plan.num_levels() )
+            gaxpy_launcher.add_region_requirement(children_requirement(plan, k, WRITE_DISCARD, FID_TILE_PASS));
+        runtime->execute_index_space(ctx, gaxpy_launcher);
+    }
+}
+
+// Issues the gaxpys of operands, MAX_BATCH tuples per launch of a level, over the union of the
+// plans of all tuples. Bit k of a tile's operands tells whether the result of tuple k has it, and
+// field FID_TILE_PASS+k of the plan region carries tuple k's passes. The outputs get no plans;
+// build_tree_plan makes one for an output that needs it.
+void gaxpy_batch(HighLevelRuntime *runtime, Context ctx, const vector<GaxpyOperands> &operands){
+    for( size_t first = 0 ; first < operands.size() ; first += MAX_BATCH ){
+        int count = static_cast<int>(min(operands.size() - first, static_cast<size_t>(MAX_BATCH)));
+        vector<TreePlan> tuples(count);
+        vector<const TreePlan *> tuple_plans;
+        for( int k = 0 ; k < count ; k++ ){
+            vector<const TreePlan *> plans;
+            plans.push_back(operands[first + k].plan1);
+            plans.push_back(operands[first + k].plan2);
+            tuples[k] = merge_plans(plans, false);
+            tuple_plans.push_back(&tuples[k]);
+        }
+        TreePlan batch = merge_plans(tuple_plans, false);
+        create_plan_region(runtime, ctx, batch, count);
+        BatchGaxpyArgs args(batch.args.max_depth, batch.args.actual_max_depth, batch.args.tile_height, count);
+        vector<vector<LogicalPartition> > blocks;
+        for( int k = 0 ; k < count ; k++ ){
+            const GaxpyOperands &op = operands[first + k];
+            args.alpha[k] = op.alpha;
+            args.beta[k] = op.beta;
+            TreePlan view = operands_of(batch, tuples[k]);
+            blocks.push_back(create_block_partitions(runtime, ctx, op.plan1->tree, view, 1));
+            blocks.push_back(create_block_partitions(runtime, ctx, op.plan2->tree, view, 2));
+            blocks.push_back(create_block_partitions(runtime, ctx, op.tree3, view, 3));
+        }
+        for( int level = 0 ; level < batch.num_levels() ; level++ ){
+            IndexTaskLauncher gaxpy_launcher(GAXPY_BATCH_TASK_ID, Domain(batch.level(level)), TaskArgument(&args, sizeof(BatchGaxpyArgs)), ArgumentMap());
+            gaxpy_launcher.tag = TILE_LEVEL_TAG;
+            count_launch(batch.level(level).volume());
+            gaxpy_launcher.add_region_requirement(RegionRequirement(batch.entries[level], 0, READ_ONLY, EXCLUSIVE, batch.region));
+            gaxpy_launcher.add_field(0, FID_TILE);
+            for( int k = 0 ; k < count ; k++ )
+                gaxpy_launcher.add_field(0, FID_TILE_PASS + k);
+            for( int r = 0 ; r < 3 * count ; r++ ){
+                const GaxpyOperands &op = operands[first + r/3];
+                LogicalRegion tree = r % 3 == 0 ? op.plan1->tree : ( r % 3 == 1 ? op.plan2->tree : op.tree3 );
+                gaxpy_launcher.add_region_requirement(RegionRequirement(blocks[r][level], 0, r % 3 == 2 ? WRITE_DISCARD : READ_ONLY, EXCLUSIVE, tree));
+                gaxpy_launcher.add_field(r + 1, FID_COEFFS);
+                gaxpy_launcher.add_field(r + 1, FID_IS_LEAF);
+            }
+            if( level + 1 < batch.num_levels() ){
+                gaxpy_launcher.add_region_requirement(children_requirement(batch, level, READ_ONLY, FID_TILE));
+                RegionRequirement passes(batch.children[level], 0, WRITE_DISCARD, EXCLUSIVE, batch.region);
+                for( int k = 0 ; k < count ; k++ )
+                    passes.add_field(FID_TILE_PASS + k);
+                gaxpy_launcher.add_region_requirement(passes);
+            }
+            runtime->execute_index_space(ctx, gaxpy_launcher);
+        }
+        for( size_t r = 0 ; r < blocks.size() ; r++ )
+            destroy_block_partitions(runtime, ctx, blocks[r]);
+        destroy_tree_plan(runtime, ctx, batch);
+    }
+}
+
+// Adds the sum of squares of the tree of plan into slot 0 of sum, one index launch per level.
+void tree_norm(HighLevelRuntime *runtime, Context ctx, const TreePlan &plan, LogicalRegion sum){
+    for( int k = 0 ; k < plan.num_levels() ; k++ ){
+        IndexTaskLauncher norm_launcher = plan_launcher(NORM_TASK_ID, plan, k, READ_ONLY);
+        norm_launcher.add_region_requirement(sum_requirement(sum));
+        runtime->execute_index_space(ctx, norm_launcher);
+    }
+}
+
+// Reconstructs the tree of plan, one index launch per level from the root down: the tiles of a
+// level leave the pass of each child tile in its plan entry, where the next launch reads it.
+// The sum of squares of the leaves goes into slot 0 of sum.
+void tree_reconstruct(HighLevelRuntime *runtime, Context ctx, const TreePlan &plan, LogicalRegion sum){
+    for( int k = 0 ; k < plan.num_levels() ; k++ ){
+        IndexTaskLauncher reconstruct_launcher = plan_launcher(RECONSTRUCT_TASK_ID, plan, k, READ_WRITE);
+        reconstruct_launcher.add_field(1, FID_TILE_PASS);
+        if( k + 1 < plan.num_levels() )
+            reconstruct_launcher.add_region_requirement(children_requirement(plan, k, WRITE_DISCARD, FID_TILE_PASS));
+        reconstruct_launcher.add_region_requirement(sum_requirement(sum));
+        runtime->execute_index_space(ctx, reconstruct_launcher);
+    }
+}
+
+// Adds the inner product of the trees of plan1 and plan2 into slot 0 of sum, one index launch
+// per level of the tiles both trees have.
+void tree_product(HighLevelRuntime *runtime, Context ctx, const TreePlan &plan1, const TreePlan &plan2, LogicalRegion sum){
+    vector<const TreePlan *> plans;
+    plans.push_back(&plan1);
+    plans.push_back(&plan2);
+    TreePlan both = merge_plans(plans, true);
+    both.tree = plan1.tree;
+    both.blocks = create_block_partitions(runtime, ctx, plan1.tree, both, 0);
+    create_plan_region(runtime, ctx, both);
+    vector<LogicalPartition> blocks2 = create_block_partitions(runtime, ctx, plan2.tree, both, 0);
+    for( int k = 0 ; k < both.num_levels() ; k++ ){
+        IndexTaskLauncher product_launcher = plan_launcher(INNER_PRODUCT_TASK_ID, both, k, READ_ONLY);
+        product_launcher.add_region_requirement(RegionRequirement(blocks2[k], 0, READ_ONLY, EXCLUSIVE, plan2.tree));
+        product_launcher.add_field(2, FID_COEFFS);
+        product_launcher.add_field(2, FID_IS_LEAF);
+        product_launcher.add_region_requirement(sum_requirement(sum));
+        runtime->execute_index_space(ctx, product_launcher);
+    }
+    destroy_block_partitions(runtime, ctx, blocks2);
+    destroy_tree_plan(runtime, ctx, both);
+}
+
+// Issues the inner products of operands, MAX_BATCH pairs per launch of a level, each summed into
+// an accumulator slot of its own. The launches run over the tiles that any pair has, and bit k
+// of a tile's operands tells whether pair k has it in both trees. Future i holds a BatchSum with
+// the products of operands i*MAX_BATCH and on.
+vector<Future> inner_product_batch(HighLevelRuntime *runtime, Context ctx, const vector<ProductOperands> &operands){
+    vector<Future> results;
+    for( size_t first = 0 ; first < operands.size() ; first += MAX_BATCH ){
+        int count = static_cast<int>(min(operands.size() - first, static_cast<size_t>(MAX_BATCH)));
+        vector<TreePlan> pairs(count);
+        vector<const TreePlan *> pair_plans;
+        for( int k = 0 ; k < count ; k++ ){
+            vector<const TreePlan *> plans;
+            plans.push_back(operands[first + k].plan1);
+            plans.push_back(operands[first + k].plan2);
+            pairs[k] = merge_plans(plans, true);
+            pair_plans.push_back(&pairs[k]);
+        }
+        TreePlan batch = merge_plans(pair_plans, false);
+        create_plan_region(runtime, ctx, batch);
+        vector<vector<LogicalPartition> > blocks;
+        for( int k = 0 ; k < count ; k++ ){
+            blocks.push_back(create_block_partitions(runtime, ctx, operands[first + k].plan1->tree, batch, 1u << k));
+            blocks.push_back(create_block_partitions(runtime, ctx, operands[first + k].plan2->tree, batch, 1u << k));
+        }
+        LogicalRegion sum = create_sum_region(runtime, ctx, MAX_BATCH);
+        for( int level = 0 ; level < batch.num_levels() ; level++ ){
+            IndexTaskLauncher product_launcher(INNER_PRODUCT_BATCH_TASK_ID, Domain(batch.level(level)), TaskArgument(&batch.args, sizeof(Arguments)), ArgumentMap());
+            product_launcher.tag = TILE_LEVEL_TAG;
+            count_launch(batch.level(level).volume());
+            product_launcher.add_region_requirement(RegionRequirement(batch.entries[level], 0, READ_ONLY, EXCLUSIVE, batch.region));
+            product_launcher.add_field(0, FID_TILE);
+            for( int r = 0 ; r < 2 * count ; r++ ){
+                const TreePlan *plan = r % 2 == 0 ? operands[first + r/2].plan1 : operands[first + r/2].plan2;
+                product_launcher.add_region_requirement(RegionRequirement(blocks[r][level], 0, READ_ONLY, EXCLUSIVE, plan->tree));
+                product_launcher.add_field(r + 1, FID_COEFFS);
+                product_launcher.add_field(r + 1, FID_IS_LEAF);
+            }
+            product_launcher.add_region_requirement(sum_requirement(sum));
+            runtime->execute_index_space(ctx, product_launcher);
         }
+        results.push_back(sum_result(runtime, ctx, sum, BATCH_SUM_RESULT_TASK_ID));
+        destroy_sum_region(runtime, ctx, sum);
+        for( size_t r = 0 ; r < blocks.size() ; r++ )
+            destroy_block_partitions(runtime, ctx, blocks[r]);
+        destroy_tree_plan(runtime, ctx, batch);
     }
-};
+    return results;
+}
 
-struct TreeArgs{
-    int value;
-    bool is_leaf;
-    TreeArgs( int _value, bool _is_leaf ) : value(_value), is_leaf(_is_leaf) {}
-};
+void run_benchmark(HighLevelRuntime *runtime, Context ctx, FieldSpace fs, int max_depth, int actual_left_depth, int tile_height, long int seed, coord_t grain, double refine_prob, const BenchConfig &config){
+    BenchStats stats[NUM_BENCH_OPS];
+    Color color1 = 10, color2 = 20, color3 = 30;
+    for( int rep = 0 ; rep < config.warmup + config.reps ; rep++ ){
+        bool timed = rep >= config.warmup;
+        LogicalRegion lr1 = create_tree_region(runtime, ctx, fs, max_depth);
+        LogicalRegion lr2 = create_tree_region(runtime, ctx, fs, max_depth);
+        LogicalRegion lr3 = create_tree_region(runtime, ctx, fs, max_depth);
+        Arguments args1(0, 0, max_depth, 0, color1, actual_left_depth, tile_height);
+        args1.gen = seed + 2 * rep;
+        args1.grain = grain;
+        args1.refine_prob = refine_prob;
+        Arguments args2 = args1;
+        args2.gen = seed + 2 * rep + 1;
+        args2.partition_color = color2;
+        TreePlan plan1, plan2;
+
+        if( !config.load_prefix.empty() ){
+            BenchTimer load_timer;
+            bool loaded = load_tree(runtime, ctx, lr1, args1, (config.load_prefix + "1.ckpt").c_str(), plan1);
+            load_timer.stop(runtime, ctx, timed && loaded, stats[BENCH_LOAD]);
+            if( !loaded || !load_tree(runtime, ctx, lr2, args2, (config.load_prefix + "2.ckpt").c_str(), plan2) ){
+                if( loaded )
+                    destroy_tree_plan(runtime, ctx, plan1);
+                destroy_tree_region(runtime, ctx, lr1);
+                destroy_tree_region(runtime, ctx, lr2);
+                destroy_tree_region(runtime, ctx, lr3);
+                cout<<"Benchmark: stopped in repetition "<<rep<<", a checkpoint failed to load"<<endl;
+                break;
+            }
+        }
+        else{
+            BenchTimer refine_timer;
+            TaskLauncher refine_launcher(REFINE_INTER_TASK_ID, TaskArgument(&args1, sizeof(Arguments)));
+            refine_launcher.add_region_requirement(RegionRequirement(lr1, WRITE_DISCARD, EXCLUSIVE, lr1).add_flags(NO_ACCESS_FLAG));
+            refine_launcher.add_field(0, FID_COEFFS);
+            refine_launcher.add_field(0, FID_IS_LEAF);
+            runtime->execute_task(ctx, refine_launcher);
+            plan1 = build_tree_plan(runtime, ctx, lr1, args1);
+            refine_timer.stop(runtime, ctx, timed, stats[BENCH_REFINE]);
+
+            TaskLauncher refine_launcher2(REFINE_INTER_TASK_ID, TaskArgument(&args2, sizeof(Arguments)));
+            refine_launcher2.add_region_requirement(RegionRequirement(lr2, WRITE_DISCARD, EXCLUSIVE, lr2).add_flags(NO_ACCESS_FLAG));
+            refine_launcher2.add_field(0, FID_COEFFS);
+            refine_launcher2.add_field(0, FID_IS_LEAF);
+            runtime->execute_task(ctx, refine_launcher2);
+            plan2 = build_tree_plan(runtime, ctx, lr2, args2);
+        }
+        runtime->issue_execution_fence(ctx).get_void_result();
+
+        BenchTimer norm_timer;
+        LogicalRegion norm_sum = create_sum_region(runtime, ctx, 1);
+        tree_norm(runtime, ctx, plan1, norm_sum);
+        sum_result(runtime, ctx, norm_sum, SUM_RESULT_TASK_ID).get_result<double>();
+        destroy_sum_region(runtime, ctx, norm_sum);
+        norm_timer.stop(runtime, ctx, timed, stats[BENCH_NORM]);
+
+        BenchTimer product_timer;
+        LogicalRegion product_sum = create_sum_region(runtime, ctx, 1);
+        tree_product(runtime, ctx, plan1, plan2, product_sum);
+        sum_result(runtime, ctx, product_sum, SUM_RESULT_TASK_ID).get_result<double>();
+        destroy_sum_region(runtime, ctx, product_sum);
+        product_timer.stop(runtime, ctx, timed, stats[BENCH_PRODUCT]);
+
+        BenchTimer gaxpy_timer;
+        Arguments args3 = args1;
+        args3.partition_color = color3;
+        GaxpyPlan gaxpy = create_gaxpy_plan(runtime, ctx, plan1, plan2, lr3, args3);
+        tree_gaxpy(runtime, ctx, gaxpy, 1.0, 1.0);
+        destroy_gaxpy_operands(runtime, ctx, gaxpy);
+        gaxpy_timer.stop(runtime, ctx, timed, stats[BENCH_GAXPY]);
+
+        if( config.batch > 0 ){
+            vector<ProductOperands> product_operands;
+            vector<GaxpyOperands> gaxpy_operands;
+            for( int k = 0 ; k < config.batch ; k++ ){
+                ProductOperands product = { &plan1, &plan2 };
+                GaxpyOperands gaxpy_batch_operand = { &plan1, &plan2, create_tree_region(runtime, ctx, fs, max_depth), 1.0, 1.0 };
+                product_operands.push_back(product);
+                gaxpy_operands.push_back(gaxpy_batch_operand);
+            }
+            BenchTimer product_batch_timer;
+            vector<Future> sums = inner_product_batch(runtime, ctx, product_operands);
+            for( size_t i = 0 ; i < sums.size() ; i++ )
+                sums[i].get_result<BatchSum>();
+            product_batch_timer.stop(runtime, ctx, timed, stats[BENCH_PRODUCT_BATCH]);
+
+            BenchTimer gaxpy_batch_timer;
+            gaxpy_batch(runtime, ctx, gaxpy_operands);
+            gaxpy_batch_timer.stop(runtime, ctx, timed, stats[BENCH_GAXPY_BATCH]);
+            for( int k = 0 ; k < config.batch ; k++ )
+                destroy_tree_region(runtime, ctx, gaxpy_operands[k].tree3);
+        }
 
+        BenchTimer compress_timer;
+        tree_compress(runtime, ctx, plan1, LogicalRegion::NO_REGION);
+        compress_timer.stop(runtime, ctx, timed, stats[BENCH_COMPRESS]);
+
+        BenchTimer reconstruct_timer;
+        LogicalRegion reconstruct_sum = create_sum_region(runtime, ctx, 1);
+        tree_reconstruct(runtime, ctx, plan1, reconstruct_sum);
+        sum_result(runtime, ctx, reconstruct_sum, SUM_RESULT_TASK_ID).get_result<double>();
+        destroy_sum_region(runtime, ctx, reconstruct_sum);
+        reconstruct_timer.stop(runtime, ctx, timed, stats[BENCH_RECONSTRUCT]);
+
+        destroy_tree_plan(runtime, ctx, plan1);
+        destroy_tree_plan(runtime, ctx, plan2);
+        destroy_tree_plan(runtime, ctx, gaxpy.result);
+        destroy_tree_region(runtime, ctx, lr1);
+        destroy_tree_region(runtime, ctx, lr2);
+        destroy_tree_region(runtime, ctx, lr3);
+    }
 
-struct HelperArgs{
-    int level;
-    coord_t idx;
-    bool launch;
-    int n;
-    bool is_valid_entry;
-    HelperArgs( int _level, coord_t _idx, bool _launch, int _n , bool _is_valid_entry ) : level(_level), idx(_idx), launch(_launch), n(_n), is_valid_entry( _is_valid_entry ) {}
-};
+    Machine::ProcessorQuery procs(Machine::get_machine());
+    procs.only_kind(Processor::LOC_PROC).local_address_space();
+    FILE *out = fopen(config.out, "a");
+    if( out == NULL ){
+        cout<<"Benchmark: cannot open "<<config.out<<endl;
+        return;
+    }
+    if( !config.json && ftell(out) == 0 )
+        fprintf(out, "op,max_depth,tile_height,refine_prob,procs,reps,best_us,mean_us,tasks,node_visits,node_visits_per_sec\n");
+    for( int op = 0 ; op < NUM_BENCH_OPS ; op++ ){
+        // Refine or load, and the batched rows without -bench_batch, never run.
+        if( stats[op].reps == 0 )
+            continue;
+        int reps = stats[op].reps;
+        double mean_us = static_cast<double>(stats[op].total_us) / reps;
+        double visits_per_sec = mean_us > 0 ? (stats[op].node_visits / reps) / (mean_us * 1e-6) : 0.0;
+        const char *format = config.json
+            ? "{\"op\":\"%s\",\"max_depth\":%d,\"tile_height\":%d,\"refine_prob\":%g,\"procs\":%zu,\"reps\":%d,\"best_us\":%lld,\"mean_us\":%.1f,\"tasks\":%lld,\"node_visits\":%lld,\"node_visits_per_sec\":%.0f}\n"
+            : "%s,%d,%d,%g,%zu,%d,%lld,%.1f,%lld,%lld,%.0f\n";
+        const char *name = bench_op_names[op];
+        fprintf(out, format, name, max_depth, tile_height, refine_prob, procs.count(), reps,
+                stats[op].best_us, mean_us, stats[op].tasks / reps, stats[op].node_visits / reps, visits_per_sec);
+        cout<<"Benchmark: "<<name<<" "<<mean_us<<" us "<<visits_per_sec<<" node visits/s"<<endl;
+    }
+    fclose(out);
+}
 
-struct GaxpyHelper{
-    int n,l;
-    coord_t idx;
-    int pass;
-    bool left_null, right_null;
-    bool launch;
-    GaxpyHelper( int _n, int _l, coord_t _idx, int _pass, bool _left_null, bool _right_null , bool _launch ) : n(_n), l(_l), idx(_idx), pass(_pass), left_null(_left_null), right_null(_right_null), launch(_launch)    {}
+enum TraceIDs{
+    ITERATION_TRACE_ID = 1,
 };
 
-void print_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctxt, HighLevelRuntime *runtime) {
-    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
-    : *(const Arguments *) task->args;
-    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > read_acc(regions[0], FID_X);
-    int node_counter=0;
-    int max_depth = args.max_depth;
-    queue<Arguments>tree;
-    tree.push(args);
-    while( !tree.empty() ){
-        Arguments temp = tree.front();
-        tree.pop();
-        int n = temp.n;
-        int l = temp.l;
-        // if( n > max_depth )
-        //     break;
-        coord_t idx = temp.idx;
-        coord_t idx_left_sub_tree = idx+1;
-        coord_t idx_right_sub_tree = idx + static_cast<coord_t>(pow(2, max_depth - n));
-        node_counter++;
-        cout<<node_counter<<": "<<n<<"~"<<l<<"~"<<idx<<"~"<<read_acc[idx].value<<endl;
-        if(!read_acc[idx].is_leaf){
-            Arguments for_left_sub_tree (n + 1, l * 2    , max_depth, idx_left_sub_tree, temp.partition_color, temp.actual_max_depth, temp.tile_height);
-            Arguments for_right_sub_tree(n + 1, l * 2 + 1, max_depth, idx_right_sub_tree, temp.partition_color, temp.actual_max_depth, temp.tile_height);
-            tree.push( for_left_sub_tree );
-            tree.push( for_right_sub_tree );
+// Iteration driver (-iterations N): runs reconstruct, tree1 = alpha*tree1 + beta*tree2 in place,
+// compress and norm on tree1 N times, each iteration inside one Legion trace. Every tile task is
+// a point of a per-level index launch issued from this context, over a level domain of plan1, so
+// the trace captures and replays the analysis of all of them. The first update gives tree1 every
+// tile of tree2 and the later ones keep that structure, so the first iteration makes the union
+// plan, which is plan1 from then on, and runs untraced; the later ones launch over the same
+// domains and partitions and create nothing.
+void run_iterations(HighLevelRuntime *runtime, Context ctx, TreePlan &plan1, const TreePlan &plan2, int iterations, double alpha, double beta){
+    GaxpyPlan gaxpy;
+    long long first_us = 0, total_us = 0;
+    Future norm;
+    // The accumulators are made once and cleared every iteration, keeping region creation and
+    // deletion out of the trace.
+    LogicalRegion reconstruct_sum = create_sum_region(runtime, ctx, 1);
+    LogicalRegion norm_sum = create_sum_region(runtime, ctx, 1);
+    for( int it = 0 ; it < iterations ; it++ ){
+        long long start_us = Realm::Clock::current_time_in_microseconds();
+        if( it > 0 )
+            runtime->begin_trace(ctx, ITERATION_TRACE_ID);
+        clear_sums(runtime, ctx, reconstruct_sum);
+        clear_sums(runtime, ctx, norm_sum);
+        tree_reconstruct(runtime, ctx, plan1, reconstruct_sum);
+
+        if( it == 0 )
+            gaxpy = create_gaxpy_plan(runtime, ctx, plan1, plan2, plan1.tree, plan1.args);
+        tree_gaxpy(runtime, ctx, gaxpy, alpha, beta);
+        if( it == 0 ){
+            destroy_tree_plan(runtime, ctx, plan1);
+            plan1 = gaxpy.result;
         }
+
+        tree_compress(runtime, ctx, plan1, LogicalRegion::NO_REGION);
+
+        tree_norm(runtime, ctx, plan1, norm_sum);
+        norm = sum_result(runtime, ctx, norm_sum, SUM_RESULT_TASK_ID);
+        if( it > 0 )
+            runtime->end_trace(ctx, ITERATION_TRACE_ID);
+        norm.get_result<double>();
+        long long elapsed = Realm::Clock::current_time_in_microseconds() - start_us;
+        if( it == 0 )
+            first_us = elapsed;
+        else
+            total_us = total_us + elapsed;
     }
+    destroy_gaxpy_operands(runtime, ctx, gaxpy);
+    destroy_sum_region(runtime, ctx, reconstruct_sum);
+    destroy_sum_region(runtime, ctx, norm_sum);
+    if( iterations == 0 )
+        return;
+    cout<<"Iterations: "<<iterations<<" first "<<first_us<<" us";
+    if( iterations > 1 )
+        cout<<" later mean "<<static_cast<double>(total_us) / (iterations - 1)<<" us";
+    cout<<" norm "<<sqrt(norm.get_result<double>())<<endl;
 }
 
 void top_level_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime) {
@@ -149,6 +1763,19 @@ void top_level_task(const Task *task, const std::vector<PhysicalRegion> &regions
     int tile_height = 4;
 
     long int seed = 12345;
+    bool autotune = false;
+    int autotune_trials = 2;
+    coord_t grain = 1024;
+    double refine_prob = 0.7;
+    bool bench = false;
+    BenchConfig bench_config;
+    bool dump = true;
+    string dump_prefix = "tree";
+    double alpha = 1.0, beta = 1.0;
+    bool gaxpy_in_place = false;
+    int iterations = 0;
+    string save_prefix;
+    string load_prefix;
     {
         const InputArgs &command_args = HighLevelRuntime::get_input_args();
         for (int idx = 1; idx < command_args.argc; ++idx)
@@ -159,907 +1786,1012 @@ void top_level_task(const Task *task, const std::vector<PhysicalRegion> &regions
                 seed = atol(command_args.argv[++idx]);
             else if(strcmp(command_args.argv[idx],"--tile") == 0)
                 tile_height = atoi( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"--autotune") == 0)
+                autotune = true;
+            else if(strcmp(command_args.argv[idx],"--autotune_trials") == 0)
+                autotune_trials = atoi( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"-grain") == 0)
+                grain = atoll( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"-refine_prob") == 0)
+                refine_prob = atof( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"--bench") == 0)
+                bench = true;
+            else if(strcmp(command_args.argv[idx],"-bench_warmup") == 0)
+                bench_config.warmup = atoi( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"-bench_reps") == 0)
+                bench_config.reps = atoi( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"-bench_batch") == 0)
+                bench_config.batch = atoi( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"-bench_format") == 0)
+                bench_config.json = strcmp(command_args.argv[++idx], "json") == 0;
+            else if(strcmp(command_args.argv[idx],"-bench_out") == 0)
+                bench_config.out = command_args.argv[++idx];
+            else if(strcmp(command_args.argv[idx],"-dump_prefix") == 0)
+                dump_prefix = command_args.argv[++idx];
+            else if(strcmp(command_args.argv[idx],"--no_dump") == 0)
+                dump = false;
+            else if(strcmp(command_args.argv[idx],"-alpha") == 0)
+                alpha = atof( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"-beta") == 0)
+                beta = atof( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"--gaxpy_in_place") == 0)
+                gaxpy_in_place = true;
+            else if(strcmp(command_args.argv[idx],"-iterations") == 0)
+                iterations = atoi( command_args.argv[++idx]);
+            else if(strcmp(command_args.argv[idx],"-save_trees") == 0)
+                save_prefix = command_args.argv[++idx];
+            else if(strcmp(command_args.argv[idx],"-load_trees") == 0)
+                load_prefix = command_args.argv[++idx];
         }
     }
-    srand(time(NULL));
-    Rect<1> tree_rect(0LL, static_cast<coord_t>(pow(2, overall_max_depth + 1)));
-    IndexSpace is = runtime->create_index_space(ctx, tree_rect);
+    assert( tile_height >= 1 && tile_height <= MAX_TILE_HEIGHT );
     FieldSpace fs = runtime->create_field_space(ctx);
     {
         FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
-        allocator.allocate_field(sizeof(TreeArgs), FID_X);
+        allocator.allocate_field(sizeof(Coefficients), FID_COEFFS);
+        allocator.allocate_field(sizeof(bool), FID_IS_LEAF);
     }
 
-    LogicalRegion lr1 = runtime->create_logical_region(ctx, is, fs);
+    if( autotune && overall_max_depth >= 2 ){
+        tile_height = autotune_tile_height(runtime, ctx, fs, overall_max_depth, actual_left_depth, autotune_trials, grain, refine_prob);
+        cout<<"Autotune: using tile height "<<tile_height<<endl;
+    }
+
+    if( bench ){
+        bench_config.load_prefix = load_prefix;
+        run_benchmark(runtime, ctx, fs, overall_max_depth, actual_left_depth, tile_height, seed, grain, refine_prob, bench_config);
+        print_counter_report(runtime, ctx, tile_height);
+        return;
+    }
+
+    LogicalRegion lr1 = create_tree_region(runtime, ctx, fs, overall_max_depth);
     Color partition_color1 = 10;
 
     Arguments args1(0, 0, overall_max_depth, 0, partition_color1, actual_left_depth, tile_height);
-    args1.gen = rand();
-    cout<<"Launching Refine Task"<<endl;
-    TaskLauncher refine_launcher(REFINE_INTER_TASK_ID, TaskArgument(&args1, sizeof(Arguments)));
-    refine_launcher.add_region_requirement(RegionRequirement(lr1, WRITE_DISCARD, EXCLUSIVE, lr1));
-    refine_launcher.add_field(0, FID_X);
-    runtime->execute_task(ctx, refine_launcher);
-
-    cout<<"Launching Print Task After Refine"<<endl;
-    TaskLauncher print_launcher(PRINT_TASK_ID, TaskArgument(&args1, sizeof(Arguments)));
-    RegionRequirement req3( lr1 , READ_ONLY, EXCLUSIVE, lr1 );
-    req3.add_field(FID_X);
-    print_launcher.add_region_requirement( req3 );
-    runtime->execute_task(ctx, print_launcher);
+    args1.gen = seed;
+    args1.grain = grain;
+    args1.refine_prob = refine_prob;
+    TreePlan plan1;
+    if( !load_prefix.empty() ){
+        cout<<"Loading Tree"<<endl;
+        if( !load_tree(runtime, ctx, lr1, args1, (load_prefix + "1.ckpt").c_str(), plan1) )
+            return;
+    }
+    else{
+        cout<<"Launching Refine Task"<<endl;
+        TaskLauncher refine_launcher(REFINE_INTER_TASK_ID, TaskArgument(&args1, sizeof(Arguments)));
+        refine_launcher.add_region_requirement(RegionRequirement(lr1, WRITE_DISCARD, EXCLUSIVE, lr1).add_flags(NO_ACCESS_FLAG));
+        refine_launcher.add_field(0, FID_COEFFS);
+        refine_launcher.add_field(0, FID_IS_LEAF);
+        runtime->execute_task(ctx, refine_launcher);
+        plan1 = build_tree_plan(runtime, ctx, lr1, args1);
+    }
+    if( !save_prefix.empty() ){
+        cout<<"Saving Tree"<<endl;
+        save_tree(runtime, ctx, plan1, (save_prefix + "1.ckpt").c_str());
+    }
+
+    if( dump ){
+        cout<<"Dumping Tree After Refine"<<endl;
+        dump_tree(runtime, ctx, plan1, (dump_prefix + "1.tmd").c_str());
+    }
 
     // cout<<"Launching Compress Task"<<endl;
-    // TaskLauncher compress_launcher(COMPRESS_INTER_TASK_ID, TaskArgument(&args1, sizeof(Arguments)));
-    // compress_launcher.add_region_requirement(RegionRequirement(lr1, WRITE_DISCARD, EXCLUSIVE, lr1));
-    // compress_launcher.add_field(0, FID_X);
-    // runtime->execute_task(ctx, compress_launcher);
-
-    // cout<<"Launching Print Task After Compress"<<endl;
-    // TaskLauncher print_launcher(PRINT_TASK_ID, TaskArgument(&args1, sizeof(Arguments)));
-    // RegionRequirement req3( lr1 , READ_ONLY, EXCLUSIVE, lr1 );
-    // req3.add_field(FID_X);
-    // print_launcher.add_region_requirement( req3 );
-    // runtime->execute_task(ctx, print_launcher);
+    // LogicalRegion compress_sum = create_sum_region(runtime, ctx, 1);
+    // tree_compress(runtime, ctx, plan1, compress_sum);
+    // cout<<"Norm of Compressed Tree "<<sqrt(sum_result(runtime, ctx, compress_sum, SUM_RESULT_TASK_ID).get_result<double>())<<endl;
+    // destroy_sum_region(runtime, ctx, compress_sum);
+
+    // cout<<"Dumping Tree After Compress"<<endl;
+    // dump_tree(runtime, ctx, plan1, (dump_prefix + "1_compressed.tmd").c_str());
 
     // cout<<"Launching Reconstruct Task"<<endl;
-    // TaskLauncher reconstruct_launcher(RECONSTRUCT_INTER_TASK_ID, TaskArgument(&args1, sizeof(Arguments)));
-    // reconstruct_launcher.add_region_requirement( RegionRequirement(lr1, WRITE_DISCARD, EXCLUSIVE, lr1) );
-    // reconstruct_launcher.add_field(0,FID_X);
-    // runtime->execute_task(ctx,reconstruct_launcher);
-
-    // cout<<"Launching Print Task After Reconstruct"<<endl;
-    // runtime->execute_task(ctx, print_launcher);
-
-    // cout<<"Launching Norm Task on Reconstruct Tree"<<endl;
-    // TaskLauncher norm_launcher(NORM_TASK_ID, TaskArgument(&args1, sizeof(Arguments)));
-    // norm_launcher.add_region_requirement( RegionRequirement(lr1, WRITE_DISCARD, EXCLUSIVE, lr1) );
-    // norm_launcher.add_field(0,FID_X);
-    // Future f = runtime->execute_task( ctx, norm_launcher );
-    // cout<<sqrt(f.get_result<int>())<<endl;
-
-    Rect<1> tree_second(0LL, static_cast<coord_t>(pow(2, overall_max_depth + 1)));
-    IndexSpace is2 = runtime->create_index_space(ctx, tree_second);
-    FieldSpace fs2 = runtime->create_field_space(ctx);
-    {
-        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs2);
-        allocator.allocate_field(sizeof(TreeArgs), FID_X);
-    }
-    LogicalRegion lr2 = runtime->create_logical_region(ctx, is2, fs2);
+    // LogicalRegion reconstruct_sum = create_sum_region(runtime, ctx, 1);
+    // tree_reconstruct(runtime, ctx, plan1, reconstruct_sum);
+
+    // cout<<"Dumping Tree After Reconstruct"<<endl;
+    // dump_tree(runtime, ctx, plan1, (dump_prefix + "1_reconstructed.tmd").c_str());
+
+    // cout<<"Norm of Reconstructed Tree"<<endl;
+    // cout<<sqrt(sum_result(runtime, ctx, reconstruct_sum, SUM_RESULT_TASK_ID).get_result<double>())<<endl;
+    // destroy_sum_region(runtime, ctx, reconstruct_sum);
+
+    LogicalRegion lr2 = create_tree_region(runtime, ctx, fs, overall_max_depth);
     Color partition_color2 = 20;
     Arguments args2(0, 0, overall_max_depth, 0, partition_color2, actual_left_depth, tile_height);
-    args2.gen = rand();
-    cout<<"Launching Refine Task For 2nd  Tree"<<endl;
-    TaskLauncher refine_launcher2(REFINE_INTER_TASK_ID, TaskArgument(&args2, sizeof(Arguments)));
-    refine_launcher2.add_region_requirement(RegionRequirement(lr2, WRITE_DISCARD, EXCLUSIVE, lr2));
-    refine_launcher2.add_field(0, FID_X);
-    runtime->execute_task(ctx, refine_launcher2);
+    args2.gen = seed + 1;
+    args2.grain = grain;
+    args2.refine_prob = refine_prob;
+    TreePlan plan2;
+    if( !load_prefix.empty() ){
+        cout<<"Loading 2nd Tree"<<endl;
+        if( !load_tree(runtime, ctx, lr2, args2, (load_prefix + "2.ckpt").c_str(), plan2) )
+            return;
+    }
+    else{
+        cout<<"Launching Refine Task For 2nd  Tree"<<endl;
+        TaskLauncher refine_launcher2(REFINE_INTER_TASK_ID, TaskArgument(&args2, sizeof(Arguments)));
+        refine_launcher2.add_region_requirement(RegionRequirement(lr2, WRITE_DISCARD, EXCLUSIVE, lr2).add_flags(NO_ACCESS_FLAG));
+        refine_launcher2.add_field(0, FID_COEFFS);
+        refine_launcher2.add_field(0, FID_IS_LEAF);
+        runtime->execute_task(ctx, refine_launcher2);
+        plan2 = build_tree_plan(runtime, ctx, lr2, args2);
+    }
+    if( !save_prefix.empty() ){
+        cout<<"Saving 2nd Tree"<<endl;
+        save_tree(runtime, ctx, plan2, (save_prefix + "2.ckpt").c_str());
+    }
 
     // cout<<"Launching Compress Task For 2nd Tree"<<endl;
-    // TaskLauncher compress_launcher2(COMPRESS_INTER_TASK_ID, TaskArgument(&args2, sizeof(Arguments)));
-    // compress_launcher2.add_region_requirement(RegionRequirement(lr2, WRITE_DISCARD, EXCLUSIVE, lr2));
-    // compress_launcher2.add_field(0, FID_X);
-    // runtime->execute_task(ctx, compress_launcher2);
-
-    cout<<"Launching Print Task For 2nd Tree"<<endl;
-    TaskLauncher print_launcher2(PRINT_TASK_ID, TaskArgument(&args2, sizeof(Arguments)));
-    RegionRequirement req4( lr2 , READ_ONLY, EXCLUSIVE, lr2 );
-    req4.add_field(FID_X);
-    print_launcher2.add_region_requirement( req4 );
-    runtime->execute_task(ctx, print_launcher2);
+    // tree_compress(runtime, ctx, plan2, LogicalRegion::NO_REGION);
 
-    // cout<<"Launching Inner Product Task"<<endl;
-    // InnerProductArgs args(0, 0, overall_max_depth, 0, partition_color1, partition_color2, actual_left_depth, tile_height);
-    // TaskLauncher product_launcher(INNER_PRODUCT_TASK_ID, TaskArgument(&args, sizeof(Arguments)));
-    // product_launcher.add_region_requirement(RegionRequirement(lr1, READ_ONLY, EXCLUSIVE, lr1));
-    // product_launcher.add_region_requirement(RegionRequirement(lr2, READ_ONLY, EXCLUSIVE, lr2) );
-    // product_launcher.add_field(0,FID_X);
-    // product_launcher.add_field(1,FID_X);
-    // Future result = runtime->execute_task( ctx, product_launcher );
-    // cout<<result.get_result<int>()<<endl;
-
-    Rect<1> gaxpy_tree(0LL, static_cast<coord_t>(pow(2, overall_max_depth + 1)));
-    IndexSpace isgaxpy = runtime->create_index_space(ctx, gaxpy_tree);
-    FieldSpace fsgaxpy = runtime->create_field_space(ctx);
-    {
-        FieldAllocator allocator = runtime->create_field_allocator(ctx, fsgaxpy);
-        allocator.allocate_field(sizeof(TreeArgs), FID_X);
+    if( dump ){
+        cout<<"Dumping 2nd Tree"<<endl;
+        dump_tree(runtime, ctx, plan2, (dump_prefix + "2.tmd").c_str());
     }
-    LogicalRegion lrgaxpy = runtime->create_logical_region(ctx, isgaxpy, fsgaxpy);
+
+    if( iterations > 0 ){
+        run_iterations(runtime, ctx, plan1, plan2, iterations, alpha, beta);
+        print_counter_report(runtime, ctx, tile_height);
+        return;
+    }
+
+    // cout<<"Launching Inner Product Task"<<endl;
+    // LogicalRegion product_sum = create_sum_region(runtime, ctx, 1);
+    // tree_product(runtime, ctx, plan1, plan2, product_sum);
+    // cout<<sum_result(runtime, ctx, product_sum, SUM_RESULT_TASK_ID).get_result<double>()<<endl;
+    // destroy_sum_region(runtime, ctx, product_sum);
+
     Color partition_color3 = 30;
-    GaxpyArgs args(0, 0, overall_max_depth, 0, partition_color1, partition_color2, partition_color3, 0, false, false, actual_left_depth, tile_height);
- 
+    if( gaxpy_in_place ){
+        cout<<"Launching Gaxpy Task In Place"<<endl;
+        GaxpyPlan gaxpy = create_gaxpy_plan(runtime, ctx, plan1, plan2, lr1, args1);
+        tree_gaxpy(runtime, ctx, gaxpy, alpha, beta);
+        destroy_gaxpy_operands(runtime, ctx, gaxpy);
+        destroy_tree_plan(runtime, ctx, plan1);
+        plan1 = gaxpy.result;
+        if( dump ){
+            cout<<"Dumping Gaxpy Tree"<<endl;
+            dump_tree(runtime, ctx, plan1, (dump_prefix + "_gaxpy.tmd").c_str());
+        }
+        print_counter_report(runtime, ctx, tile_height);
+        return;
+    }
+
+    LogicalRegion lrgaxpy = create_tree_region(runtime, ctx, fs, overall_max_depth);
+    Arguments args3(0, 0, overall_max_depth, 0, partition_color3, actual_left_depth, tile_height);
+
     cout<<"Launching Gaxpy Taks for Tree"<<endl;
-    TaskLauncher gaxpy_launcher(GAXPY_INTER_TASK_ID, TaskArgument(&args, sizeof(GaxpyArgs)));
-    RegionRequirement req1(lr1, READ_ONLY, EXCLUSIVE, lr1);
-    req1.add_field(FID_X);
-    RegionRequirement req2(lr2, READ_ONLY, EXCLUSIVE , lr2);
-    req2.add_field(FID_X);
-    RegionRequirement reqgaxpy(lrgaxpy, WRITE_DISCARD, EXCLUSIVE, lrgaxpy);
-    reqgaxpy.add_field(FID_X);
-    gaxpy_launcher.add_region_requirement(req1);
-    gaxpy_launcher.add_region_requirement(req2);
-    gaxpy_launcher.add_region_requirement(reqgaxpy);
-    runtime->execute_task(ctx, gaxpy_launcher);
-    cout<<"Launching Print Task for Gaxpy"<<endl;
-    TaskLauncher print_gaxpy(PRINT_TASK_ID, TaskArgument(&args2, sizeof(Arguments)));
-    RegionRequirement gaxpy_req( lrgaxpy , READ_ONLY, EXCLUSIVE, lrgaxpy );
-    gaxpy_req.add_field(FID_X);
-    print_gaxpy.add_region_requirement( gaxpy_req );
-    runtime->execute_task(ctx, print_gaxpy );
+    GaxpyPlan gaxpy = create_gaxpy_plan(runtime, ctx, plan1, plan2, lrgaxpy, args3);
+    tree_gaxpy(runtime, ctx, gaxpy, alpha, beta);
+    destroy_gaxpy_operands(runtime, ctx, gaxpy);
+    if( dump ){
+        cout<<"Dumping Gaxpy Tree"<<endl;
+        dump_tree(runtime, ctx, gaxpy.result, (dump_prefix + "_gaxpy.tmd").c_str());
+    }
 
+    print_counter_report(runtime, ctx, tile_height);
 }
 
 
 
-void refine_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+struct RefineVisitor : public PreOrderVisitor{
+    const TreeAccessor<WRITE_DISCARD,WRITE_DISCARD> &tree_acc;
+    int max_depth;
+    random_t seed;
+    double refine_prob;
+    Frontier &result;
+    RefineVisitor( const TreeAccessor<WRITE_DISCARD,WRITE_DISCARD> &_tree_acc, int _max_depth, random_t _seed, double _refine_prob, Frontier &_result ) : tree_acc(_tree_acc), max_depth(_max_depth), seed(_seed), refine_prob(_refine_prob), result(_result) {}
+    bool visit(FrontierEntry &node){
+        result.nodes++;
+        if (node_uniform(seed, node.n, node.l, 0) >= refine_prob || node.n == max_depth - 1) {
+            for( int j = 0 ; j < NUM_COEFFS ; j++ )
+                tree_acc.coeffs[node.idx].c[j] = node_uniform(seed, node.n, node.l, j + 1);
+            tree_acc.is_leaf[node.idx] =true;
+            return false;
+        }
+        tree_acc.is_leaf[node.idx] = false;
+        return true;
+    }
+    void frontier(const FrontierEntry &node){
+        result.entries.push_back(node);
+    }
+};
+
+Frontier refine_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
 
     Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
     : *(const Arguments *) task->args;
-    queue<Arguments>tree;
-    tree.push(args);
-    LogicalRegion lr = regions[0].get_logical_region();
-    LogicalPartition lp = LogicalPartition::NO_PART;
-    LogicalRegion my_sub_tree_lr = lr;
-    coord_t idx_left_sub_tree = 0LL;
-    coord_t idx_right_sub_tree = 0LL;
-    int max_depth = args.max_depth;
-    int tile_height = args.tile_height;
-    int helper_counter=0;
-    const FieldAccessor<WRITE_DISCARD,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > helper_acc(regions[1], FID_X);
-    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree_acc(regions[0], FID_X);
-    while(!tree.empty()){
-        Arguments temp = tree.front();
-        tree.pop();
-        int n = temp.n;
-        int l = temp.l;
-        coord_t idx = temp.idx;
-        idx_left_sub_tree = idx+1;
-        idx_right_sub_tree = idx + static_cast<coord_t>(pow(2, max_depth - n));
-        long int node_value=rand();
-        node_value = node_value % 10 + 1;
-        if (node_value <= 3 || n == max_depth - 1) {
-            tree_acc[idx].value = node_value % 3 + 1;
-            tree_acc[idx].is_leaf =true;
-        }
-        else {
-            tree_acc[idx].value = 0;
-        }
-        if( (node_value > 3 )&&( n < max_depth ) ){
-            if( (n % tile_height )==( tile_height-1 ) ){
-                helper_acc[helper_counter].level = l;
-                helper_acc[helper_counter].idx = idx;
-                helper_acc[helper_counter].n = n;
-                helper_acc[helper_counter].launch = true;
-                helper_counter++;
-            }
-            else{
-                Arguments for_left_sub_tree (n + 1, l * 2    , max_depth, idx_left_sub_tree, temp.partition_color, temp.actual_max_depth, tile_height);
-                Arguments for_right_sub_tree(n + 1, l * 2 + 1, max_depth, idx_right_sub_tree, temp.partition_color, temp.actual_max_depth, tile_height);
-                tree.push( for_left_sub_tree );
-                tree.push( for_right_sub_tree );
-            }
-        }
-        
-    }
+    TaskProbe probe(runtime, ctx, task->task_id);
+    Frontier frontier;
+    const TreeAccessor<WRITE_DISCARD,WRITE_DISCARD> tree_acc(regions[0]);
+    clear_tile_block(tree_acc, args.idx, tile_extent(args.max_depth, args.n, args.tile_height));
+    RefineVisitor visitor(tree_acc, args.max_depth, args.gen, args.refine_prob, frontier);
+    walk_tile(args.max_depth, args.tile_height, FrontierEntry(args.n, args.l, args.idx), visitor);
+    return frontier;
 }
 
 
-void gaxpy_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
-    GaxpyArgs args = task->is_index_space ? *(const GaxpyArgs *) task->local_args
-    : *(const GaxpyArgs *) task->args;
-    int tile_height = args.tile_height;
-    queue<GaxpyArgs>tree;
-    tree.push(args);
-    coord_t idx_left_sub_tree = 0LL;
-    coord_t idx_right_sub_tree = 0LL;
-    int helper_counter=0;
-    int max_depth = args.max_depth;
-    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree1(regions[0], FID_X);
-    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree2(regions[1], FID_X);
-    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree3(regions[2], FID_X);    
-    const FieldAccessor<WRITE_DISCARD,GaxpyHelper,1,coord_t,Realm::AffineAccessor<GaxpyHelper,1,coord_t> > helper_acc(regions[3], FID_X);  
-
-    while(!tree.empty()){
-        GaxpyArgs temp = tree.front();
-        tree.pop();
-        int n = temp.n;
-        int l = temp.l;
-        int pass = temp.pass;
-        coord_t idx = temp.idx;
-        idx_left_sub_tree = idx+1;
-        idx_right_sub_tree = idx + static_cast<coord_t>(pow(2, max_depth - n));
-        bool left_null = temp.left_null;
-        bool right_null = temp.right_null;
-        int value;
-        if( n > max_depth )
-            break;
-        if( left_null ){
-            if(tree2[idx].is_leaf){
-                value = pass + tree2[idx].value;
-                tree3[idx].value = value;
-                tree3[idx].is_leaf = true;
-            }
-            else{
-                if((n%tile_height)==(tile_height-1)){
-                    helper_acc[helper_counter].n=n;
-                    helper_acc[helper_counter].l=l;
-                    helper_acc[helper_counter].pass = pass/2;
-                    helper_acc[helper_counter].launch = true;
-                    helper_acc[helper_counter].idx = idx;
-                    helper_acc[helper_counter].left_null = left_null;
-                    helper_acc[helper_counter].right_null = right_null;
-                    helper_counter++;
-                }
-                else{
-                    GaxpyArgs for_left_sub_tree( n+1, l*2, max_depth, idx_left_sub_tree, temp.partition_color1, temp.partition_color2, temp.partition_color3, pass/2, left_null, right_null, temp.actual_max_depth, temp.tile_height);
-                    GaxpyArgs for_right_sub_tree(n+1, l*2, max_depth, idx_right_sub_tree, temp.partition_color1, temp.partition_color2, temp.partition_color3, pass/2, left_null, right_null, temp.actual_max_depth, temp.tile_height);
-                    tree.push( for_left_sub_tree );
-                    tree.push( for_right_sub_tree );
-                }
-            }
+// Writes alpha*tree1 + beta*tree2 into tree3, which is tree1 itself for the update in place.
+// state[r] is the pass and null flags at relative depth r of the walk, which the children of the
+// node there inherit; the pass is only copied down once a tree has ended.
+template<typename Tree1, typename Tree3>
+struct GaxpyVisitor : public PreOrderVisitor{
+    const Tree1 &tree1;
+    const TreeAccessor<READ_ONLY,READ_ONLY> &tree2;
+    const Tree3 &tree3;
+    double alpha, beta;
+    int max_depth, tile_root;
+    Frontier &result;
+    FrontierPass state[MAX_TILE_HEIGHT];
+    GaxpyVisitor( const Tree1 &_tree1,
+                  const TreeAccessor<READ_ONLY,READ_ONLY> &_tree2,
+                  const Tree3 &_tree3,
+                  double _alpha, double _beta,
+                  int _max_depth, int _tile_root, const FrontierPass &root_state, Frontier &_result ) : tree1(_tree1), tree2(_tree2), tree3(_tree3), alpha(_alpha), beta(_beta), max_depth(_max_depth), tile_root(_tile_root), result(_result) {
+        state[0] = root_state;
+    }
+    // Only tree3 is prefetched: the blocks of a tree that has ended are not mapped.
+    void prefetch(coord_t idx) const {
+        prefetch_coeffs(tree3.coeffs, idx);
+    }
+    // Writes the result at node.idx; for interior nodes leaves what the children inherit in state.
+    // Both operands are read before the node is written, since tree3 may be tree1.
+    bool visit(FrontierEntry &node){
+        coord_t idx = node.idx;
+        if( node.n > max_depth )
+            return false;
+        int r = node.n - tile_root;
+        FrontierPass &here = state[r];
+        if( r > 0 ){
+            const FrontierPass &parent = state[r-1];
+            here.left_null = parent.left_null;
+            here.right_null = parent.right_null;
+            if( here.left_null || here.right_null )
+                here.pass = parent.pass;
         }
-        else if( right_null ){
-            if( tree1[idx].is_leaf){
-                value = pass + tree1[idx].value;
-                tree3[idx].value = value;
-                tree3[idx].is_leaf = true;
+        bool leaf1 = !here.left_null && tree1.is_leaf[idx];
+        bool leaf2 = !here.right_null && tree2.is_leaf[idx];
+        if( here.left_null ){
+            if( leaf2 ){
+                axpby_coeffs(1.0, here.pass.c, beta, tree2.coeffs[idx].c, tree3.coeffs[idx].c, NUM_COEFFS);
+                tree3.is_leaf[idx] = true;
+                return false;
             }
-            else{
-                if((n%tile_height)==(tile_height-1)){
-                    helper_acc[helper_counter].n=n;
-                    helper_acc[helper_counter].l=l;
-                    helper_acc[helper_counter].pass = pass/2;
-                    helper_acc[helper_counter].launch = true;
-                    helper_acc[helper_counter].idx = idx;
-                    helper_acc[helper_counter].left_null = left_null;
-                    helper_acc[helper_counter].right_null = right_null;
-                    helper_counter++;
-                }
-                else{
-                    GaxpyArgs for_left_sub_tree( n+1, l*2, max_depth, idx_left_sub_tree, temp.partition_color1, temp.partition_color2, temp.partition_color3, pass/2, left_null, right_null, temp.actual_max_depth, temp.tile_height);
-                    GaxpyArgs for_right_sub_tree(n+1, l*2, max_depth, idx_right_sub_tree, temp.partition_color1, temp.partition_color2, temp.partition_color3, pass/2, left_null, right_null, temp.actual_max_depth, temp.tile_height);
-                    tree.push( for_left_sub_tree );
-                    tree.push( for_right_sub_tree );
-                }   
+            scale_coeffs(0.5, here.pass.c, here.pass.c, NUM_COEFFS);
+        }
+        else if( here.right_null ){
+            if( leaf1 ){
+                axpby_coeffs(alpha, tree1.coeffs[idx].c, 1.0, here.pass.c, tree3.coeffs[idx].c, NUM_COEFFS);
+                tree3.is_leaf[idx] = true;
+                return false;
             }
+            scale_coeffs(0.5, here.pass.c, here.pass.c, NUM_COEFFS);
         }
         else{
-            if( (tree1[idx].is_leaf )&&( tree2[idx].is_leaf )){
-                value = tree1[idx].value + tree2[idx].value;
-                tree3[idx].value = value;
-                tree3[idx].is_leaf = true;
+            if( leaf1 && leaf2 ){
+                axpby_coeffs(alpha, tree1.coeffs[idx].c, beta, tree2.coeffs[idx].c, tree3.coeffs[idx].c, NUM_COEFFS);
+                tree3.is_leaf[idx] = true;
+                return false;
             }
-            else if(tree1[idx].is_leaf){
-                value = tree1[idx].value;
-                if((n%tile_height)==(tile_height-1)){
-                    helper_acc[helper_counter].n=n;
-                    helper_acc[helper_counter].l=l;
-                    helper_acc[helper_counter].pass = value/2;
-                    helper_acc[helper_counter].launch = true;
-                    helper_acc[helper_counter].idx = idx;
-                    helper_acc[helper_counter].left_null = true;
-                    helper_acc[helper_counter].right_null = right_null;
-                    helper_counter++;
-                }
-                else{
-                    GaxpyArgs for_left_sub_tree( n+1, l*2, max_depth, idx_left_sub_tree, temp.partition_color1, temp.partition_color2, temp.partition_color3, value/2, true, right_null, temp.actual_max_depth, temp.tile_height);
-                    GaxpyArgs for_right_sub_tree(n+1, l*2, max_depth, idx_right_sub_tree, temp.partition_color1, temp.partition_color2, temp.partition_color3, value/2, true, right_null, temp.actual_max_depth, temp.tile_height);
-                    tree.push( for_left_sub_tree );
-                    tree.push( for_right_sub_tree );
-                }   
-            }
-            else if(tree2[idx].is_leaf){
-                value = tree2[idx].value;
-                if((n%tile_height)==(tile_height-1)){
-                    helper_acc[helper_counter].n=n;
-                    helper_acc[helper_counter].l=l;
-                    helper_acc[helper_counter].pass = value/2;
-                    helper_acc[helper_counter].launch = true;
-                    helper_acc[helper_counter].idx = idx;
-                    helper_acc[helper_counter].left_null = left_null;
-                    helper_acc[helper_counter].right_null = true;
-                    helper_counter++;
-                }
-                else{
-                    GaxpyArgs for_left_sub_tree( n+1, l*2, max_depth, idx_left_sub_tree, temp.partition_color1, temp.partition_color2, temp.partition_color3, value/2, left_null, true, temp.actual_max_depth, temp.tile_height);
-                    GaxpyArgs for_right_sub_tree(n+1, l*2, max_depth, idx_right_sub_tree, temp.partition_color1, temp.partition_color2, temp.partition_color3, value/2, left_null, true, temp.actual_max_depth, temp.tile_height);
-                    tree.push( for_left_sub_tree );
-                    tree.push( for_right_sub_tree );
-                }   
+            else if( leaf1 ){
+                scale_coeffs(0.5 * alpha, tree1.coeffs[idx].c, here.pass.c, NUM_COEFFS);
+                here.left_null = true;
             }
-            else{
-                if((n%tile_height)==(tile_height-1)){
-                    helper_acc[helper_counter].n=n;
-                    helper_acc[helper_counter].l=l;
-                    helper_acc[helper_counter].pass = 0;
-                    helper_acc[helper_counter].launch = true;
-                    helper_acc[helper_counter].idx = idx;
-                    helper_acc[helper_counter].left_null = left_null;
-                    helper_acc[helper_counter].right_null = right_null;
-                    helper_counter++;
-                }
-                else{
-                    GaxpyArgs for_left_sub_tree( n+1, l*2, max_depth, idx_left_sub_tree, temp.partition_color1, temp.partition_color2, temp.partition_color3, 0, left_null, right_null, temp.actual_max_depth, temp.tile_height);
-                    GaxpyArgs for_right_sub_tree(n+1, l*2, max_depth, idx_right_sub_tree, temp.partition_color1, temp.partition_color2, temp.partition_color3, 0, left_null, right_null, temp.actual_max_depth, temp.tile_height);
-                    tree.push( for_left_sub_tree );
-                    tree.push( for_right_sub_tree );
-                }   
+            else if( leaf2 ){
+                scale_coeffs(0.5 * beta, tree2.coeffs[idx].c, here.pass.c, NUM_COEFFS);
+                here.right_null = true;
             }
         }
+        tree3.coeffs[idx] = Coefficients();
+        tree3.is_leaf[idx] = false;
+        return true;
+    }
+    void frontier(const FrontierEntry &node){
+        result.entries.push_back(node);
+        result.passes.push_back(state[node.n - tile_root]);
+    }
+};
+
+// Gaxpy of one tile, shared by gaxpy_task and the batched gaxpy. Where both trees go on below the
+// tile, the children inherit an empty pass.
+Frontier gaxpy_tile(const GaxpyArgs &args, const PhysicalRegion &region1, const PhysicalRegion &region2, const PhysicalRegion &region3){
+    Frontier frontier;
+    // A tree that already ended above this tile has no block here and comes without a region.
+    TreeAccessor<READ_ONLY,READ_ONLY> tree1;
+    TreeAccessor<READ_ONLY,READ_ONLY> tree2;
+    if( !args.left_null )
+        tree1 = TreeAccessor<READ_ONLY,READ_ONLY>(region1);
+    if( !args.right_null )
+        tree2 = TreeAccessor<READ_ONLY,READ_ONLY>(region2);
+    const TreeAccessor<WRITE_DISCARD,WRITE_DISCARD> tree3(region3);
+    coord_t extent = tile_extent(args.max_depth, args.n, args.tile_height);
+    if( !args.left_null && !args.right_null ){
+        Rect<1> block(args.idx, args.idx + extent - 1);
+        const bool *leaf1 = tree1.is_leaf.ptr(block);
+        const bool *leaf2 = tree2.is_leaf.ptr(block);
+        // Identical structure: every node is either a leaf in both trees or interior in both.
+        if( same_structure(leaf1, leaf2, extent) ){
+            axpby_leaves(args.alpha, tree1.coeffs.ptr(block)->c, args.beta, tree2.coeffs.ptr(block)->c, leaf1, tree3.coeffs.ptr(block)->c, extent, NUM_COEFFS);
+            memcpy(tree3.is_leaf.ptr(block), leaf1, extent * sizeof(bool));
+            StructureVisitor visitor(tree1.is_leaf, frontier);
+            walk_tile(args.max_depth, args.tile_height, FrontierEntry(args.n, args.l, args.idx), visitor);
+            frontier.passes.resize(frontier.entries.size());
+            return frontier;
+        }
     }
+    clear_tile_block(tree3, args.idx, extent);
+    GaxpyVisitor<TreeAccessor<READ_ONLY,READ_ONLY>, TreeAccessor<WRITE_DISCARD,WRITE_DISCARD> > visitor(tree1, tree2, tree3, args.alpha, args.beta, args.max_depth, args.n, FrontierPass(args.pass, args.left_null, args.right_null), frontier);
+    walk_tile(args.max_depth, args.tile_height, FrontierEntry(args.n, args.l, args.idx), visitor);
+    return frontier;
+}
 
+// Gaxpy of one tile in place. Where tree1 had ended above the tile, the block is new to tree1
+// and starts empty; where tree2 has, tree1 is only scaled and takes the pass on its leaves.
+Frontier gaxpy_in_place_tile(const GaxpyArgs &args, const PhysicalRegion &region1, const PhysicalRegion &region2){
+    Frontier frontier;
+    const TreeAccessor<READ_WRITE,READ_WRITE> tree1(region1);
+    TreeAccessor<READ_ONLY,READ_ONLY> tree2;
+    if( !args.right_null )
+        tree2 = TreeAccessor<READ_ONLY,READ_ONLY>(region2);
+    coord_t extent = tile_extent(args.max_depth, args.n, args.tile_height);
+    Rect<1> block(args.idx, args.idx + extent - 1);
+    if( args.left_null )
+        clear_tile_block(tree1, args.idx, extent);
+    else if( !args.right_null && same_structure(tree1.is_leaf.ptr(block), tree2.is_leaf.ptr(block), extent) ){
+        double *values = tree1.coeffs.ptr(block)->c;
+        axpby_leaves(args.alpha, values, args.beta, tree2.coeffs.ptr(block)->c, tree1.is_leaf.ptr(block), values, extent, NUM_COEFFS);
+        const FieldAccessor<READ_ONLY,bool,1,coord_t,Realm::AffineAccessor<bool,1,coord_t> > is_leaf(region1, FID_IS_LEAF);
+        StructureVisitor visitor(is_leaf, frontier);
+        walk_tile(args.max_depth, args.tile_height, FrontierEntry(args.n, args.l, args.idx), visitor);
+        frontier.passes.resize(frontier.entries.size());
+        return frontier;
+    }
+    GaxpyVisitor<TreeAccessor<READ_WRITE,READ_WRITE>, TreeAccessor<READ_WRITE,READ_WRITE> > visitor(tree1, tree2, tree1, args.alpha, args.beta, args.max_depth, args.n, FrontierPass(args.pass, args.left_null, args.right_null), frontier);
+    walk_tile(args.max_depth, args.tile_height, FrontierEntry(args.n, args.l, args.idx), visitor);
+    return frontier;
+}
 
+// Arguments of the tile of a gaxpy launch point: those of the launch, with the position from
+// the tile's plan entry and the pass its parent tile left in field.
+GaxpyArgs plan_gaxpy_arguments(const GaxpyArgs &launch, const Task *task, const PhysicalRegion &entry, FieldID field){
+    TilePlan tile = plan_entry(task, entry);
+    FrontierPass pass = plan_pass(task, entry, field);
+    GaxpyArgs args = launch;
+    args.n = tile.n;
+    args.l = tile.l;
+    args.idx = tile.idx;
+    args.pass = pass.pass;
+    args.left_null = pass.left_null;
+    args.right_null = pass.right_null;
+    return args;
+}
 
+// One tile of a gaxpy level launch (see tree_gaxpy). Regions: 0 the block of the result, 1 the
+// plan entry with the pass from the parent tile, then the blocks of tree1 (out of place only)
+// and tree2, and the passes of the child tiles when the level has a level below it. An operand
+// that ended above the tile has an empty block here.
+void gaxpy_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    GaxpyArgs args = plan_gaxpy_arguments(*(const GaxpyArgs *) task->args, task, regions[1], FID_TILE_PASS);
+    TaskProbe probe(runtime, ctx, task->task_id);
+    TilePlan tile = plan_entry(task, regions[1]);
+    size_t next_region = 2;
+    Frontier frontier;
+    if( args.in_place )
+        frontier = gaxpy_in_place_tile(args, regions[0], regions[next_region++]);
+    else{
+        const PhysicalRegion &region1 = regions[next_region++];
+        const PhysicalRegion &region2 = regions[next_region++];
+        frontier = gaxpy_tile(args, region1, region2, regions[0]);
+    }
+    if( tile.children > 0 )
+        write_child_passes(regions[next_region], FID_TILE_PASS, tile, frontier);
+}
 
+// Rough node count of a child subtree with levels_left levels, extrapolated from the tile just
+// refined: every tile below is taken to repeat its node count and its number of child tiles.
+// Counting stops once the estimate reaches limit.
+coord_t estimate_subtree_nodes(const Frontier &frontier, int levels_left, int tile_height, coord_t limit){
+    coord_t branching = 2 * frontier.entries.size();
+    coord_t tiles = 1;
+    coord_t estimate = 0;
+    for( int level = 0 ; level < levels_left && estimate < limit ; level += tile_height ){
+        estimate = estimate + tiles * frontier.nodes;
+        tiles = tiles * branching;
+    }
+    return estimate;
 }
-void gaxpy_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
-    GaxpyArgs args = task->is_index_space ? *(const GaxpyArgs *) task->local_args
-    : *(const GaxpyArgs *) task->args;
-    int tile_height = args.tile_height;
-    int max_depth = args.max_depth;
-    Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height-1)));
-    IndexSpace is = runtime->create_index_space(ctx, helper_Array);
-    FieldSpace fs = runtime->create_field_space(ctx);
-    {
-        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
-        allocator.allocate_field(sizeof(GaxpyHelper), FID_X);
-    }
-    LogicalRegion tree1 = regions[0].get_logical_region();
-    LogicalRegion tree2 = regions[1].get_logical_region();
-    LogicalRegion tree3 = regions[2].get_logical_region();
-    LogicalRegion new_helper_Region = runtime->create_logical_region(ctx, is, fs);
-    RegionRequirement req1(tree1, READ_ONLY, EXCLUSIVE, tree1);
-    req1.add_field(FID_X);
-    RegionRequirement req2(tree2, READ_ONLY, EXCLUSIVE, tree2);
-    req2.add_field(FID_X);
-    RegionRequirement req3(tree3, WRITE_DISCARD, EXCLUSIVE, tree3);
-    req3.add_field(FID_X);
-    RegionRequirement req4(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
-    req4.add_field(FID_X);
-    TaskLauncher gaxpy_intra_launcher(GAXPY_INTRA_TASK_ID, TaskArgument(&args,sizeof(GaxpyArgs)));
-    gaxpy_intra_launcher.add_region_requirement(req1);
-    gaxpy_intra_launcher.add_region_requirement(req2);
-    gaxpy_intra_launcher.add_region_requirement(req3);
-    gaxpy_intra_launcher.add_region_requirement(req4);
-    runtime->execute_task(ctx,gaxpy_intra_launcher);
-    ArgumentMap arg_map;
-    PhysicalRegion physicalRegion = runtime->map_region( ctx, req4 );
-    const FieldAccessor<READ_ONLY,GaxpyHelper,1,coord_t,Realm::AffineAccessor<GaxpyHelper,1,coord_t> > read_acc(physicalRegion, FID_X);
-    int task_counter = 0;
-    vector<pair<coord_t,coord_t> >color_index;
-    for( int i = 0 ; i < (1<<(tile_height-1)); i++){
-        if(!read_acc[i].launch)
-            break;
-        coord_t idx = read_acc[i].idx;
-        int l = read_acc[i].l;
-        int nx = read_acc[i].n;
-        int pass = read_acc[i].pass;
-        bool left_null = read_acc[i].left_null;
-        bool right_null = read_acc[i].right_null;
-        coord_t idx_left_sub_tree = idx+1;
-        coord_t idx_right_sub_tree = idx+ static_cast<coord_t>(pow(2, max_depth - nx));
-        GaxpyArgs left_args( nx+1, 2*l , args.max_depth, idx_left_sub_tree, args.partition_color1, args.partition_color2, args.partition_color3, pass, left_null, right_null , args.actual_max_depth, args.tile_height);
-        GaxpyArgs right_args( nx+1, 2*l +1 , args.max_depth, idx_right_sub_tree, args.partition_color1, args.partition_color2, args.partition_color3, pass, left_null, right_null , args.actual_max_depth, args.tile_height);
-        arg_map.set_point( task_counter, TaskArgument(&left_args, sizeof(GaxpyArgs)));
-        task_counter++;
-        arg_map.set_point( task_counter, TaskArgument(&right_args, sizeof(GaxpyArgs)));        
-        task_counter++;
-        color_index.push_back(make_pair(idx_left_sub_tree,idx_right_sub_tree-1));
-        color_index.push_back(make_pair(idx_right_sub_tree, idx_right_sub_tree +  static_cast<coord_t>(pow(2, max_depth - nx)) - 2) );
-    }
-    if( task_counter > 0 ){
-        IndexSpace is = tree3.get_index_space();
-        DomainPointColoring coloring;
-        for( int i = 0 ; i < task_counter ; i++ ){
-            coloring[i]= Rect<1>(color_index[i].first,color_index[i].second);
-        }
-        Rect<1>color_space = Rect<1>(0,task_counter-1);
-        IndexPartition ip = runtime->create_index_partition(ctx, is, color_space, coloring, DISJOINT_KIND, args.partition_color3);
-        LogicalPartition lp = runtime->get_logical_partition(ctx, tree3, ip);
-        Rect<1> launch_domain(0,task_counter-1);
-        IndexTaskLauncher gaxpy_launcher(GAXPY_INTER_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
-        RegionRequirement newregion(lp,0,WRITE_DISCARD,EXCLUSIVE,tree3);
-        newregion.add_field(0,FID_X);
-        gaxpy_launcher.add_region_requirement(req1);
-        gaxpy_launcher.add_region_requirement(req2);
-        gaxpy_launcher.add_region_requirement(newregion);
-        runtime->execute_index_space(ctx, gaxpy_launcher);
-    }  
+
+// Refines the tile of args at the top of lr, a subregion of parent: partitions lr by the tile and
+// launches the intra task on its block. The frontier comes back as a future.
+Future launch_refine_intra(HighLevelRuntime *runtime, Context ctx, const Arguments &args, LogicalRegion lr, LogicalRegion parent){
+    LogicalPartition lp = create_tile_partition(runtime, ctx, lr, args.max_depth, args.n, args.idx, args.tile_height, args.partition_color);
+    TaskLauncher refine_intra_launcher(REFINE_INTRA_TASK_ID, TaskArgument(&args, sizeof(Arguments) ) );
+    RegionRequirement req1(runtime->get_logical_subregion_by_color(ctx, lp, TILE_BLOCK_COLOR), WRITE_DISCARD, EXCLUSIVE, parent);
+    req1.add_field(FID_COEFFS);
+    req1.add_field(FID_IS_LEAF);
+    refine_intra_launcher.add_region_requirement(req1);
+    return runtime->execute_task(ctx, refine_intra_launcher);
 }
 
-void refine_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime) {
+// Hands the frontier of the tile at the top of lr, as a future, to a children task that launches
+// the child tiles once the tile is refined.
+void launch_refine_children(HighLevelRuntime *runtime, Context ctx, const Arguments &args, LogicalRegion lr, LogicalRegion parent, const Future &frontier){
+    TaskLauncher children_launcher(REFINE_CHILDREN_TASK_ID, TaskArgument(&args, sizeof(Arguments)));
+    children_launcher.add_region_requirement(RegionRequirement(lr, READ_WRITE, EXCLUSIVE, parent).add_flags(NO_ACCESS_FLAG));
+    children_launcher.add_field(0, FID_COEFFS);
+    children_launcher.add_field(0, FID_IS_LEAF);
+    children_launcher.add_future(frontier);
+    runtime->execute_task(ctx, children_launcher);
+}
 
+// Refines the subtree of lr.
+void refine_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime) {
     Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
     : *(const Arguments *) task->args;
-    int tile_height = args.tile_height;
+    TaskProbe probe(runtime, ctx, task->task_id);
     LogicalRegion lr = regions[0].get_logical_region();
+    launch_refine_children(runtime, ctx, args, lr, lr, launch_refine_intra(runtime, ctx, args, lr, lr));
+}
+
+// Launches the child tiles of a refined tile. Its frontier is a future of the task, which Legion
+// completes before the task starts, so reading it does not wait. Child subtrees whose estimated
+// size is below args.grain are refined from here without an inter task of their own: the intra
+// tasks of all of them are launched first and their children tasks after, so the light tiles run
+// side by side. The heavy ones become points of an index launch, which the mapper lets idle
+// processors steal.
+void refine_children_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    Arguments args = *(const Arguments *) task->args;
+    TaskProbe probe(runtime, ctx, task->task_id);
+    Frontier frontier = task->futures[0].get_result<Frontier>();
+    int tile_height = args.tile_height;
     int max_depth = args.max_depth;
-    Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height-1)));
-    IndexSpace is = runtime->create_index_space(ctx, helper_Array);
-    FieldSpace fs = runtime->create_field_space(ctx);
-    {
-        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
-        allocator.allocate_field(sizeof(HelperArgs), FID_X);
-    }
-    LogicalRegion new_helper_Region = runtime->create_logical_region(ctx, is, fs);
-    TaskLauncher refine_intra_launcher(REFINE_INTRA_TASK_ID, TaskArgument(&args, sizeof(Arguments) ) );
-    RegionRequirement req1(lr, WRITE_DISCARD, EXCLUSIVE, lr);
-    RegionRequirement req2(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
-    req1.add_field(FID_X);
-    req2.add_field(FID_X);
-    refine_intra_launcher.add_region_requirement(req1);
-    refine_intra_launcher.add_region_requirement(req2);
-    runtime->execute_task(ctx,refine_intra_launcher);
+    LogicalRegion lr = regions[0].get_logical_region();
+    LogicalPartition lp = runtime->get_logical_partition_by_color(ctx, lr, args.partition_color);
     ArgumentMap arg_map;
-    PhysicalRegion physicalRegion = runtime->map_region( ctx, req2 );
-    const FieldAccessor<READ_ONLY,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > read_acc(physicalRegion, FID_X);
-    int task_counter=0;
-    vector<pair<coord_t,coord_t> >color_index;
-    for( int i = 0 ; i < (1<<(tile_height-1)); i++ ){
-        if(!read_acc[i].launch)
-            break;
-        coord_t idx = read_acc[i].idx;
-        int level = read_acc[i].level;
-        int nx = read_acc[i].n;
-        coord_t idx_left_sub_tree = idx+1;
-        coord_t idx_right_sub_tree = idx+ static_cast<coord_t>(pow(2, max_depth - nx));
-        Arguments left_args( nx+1 , 2*level , args.max_depth, idx_left_sub_tree , args.partition_color , args.actual_max_depth , args.tile_height);
-        Arguments right_args( nx+1 , 2*level+1 , args.max_depth, idx_right_sub_tree , args.partition_color, args.actual_max_depth, args.tile_height);
-        arg_map.set_point( task_counter , TaskArgument(&left_args,sizeof(Arguments)));
-        task_counter++;
-        arg_map.set_point( task_counter, TaskArgument(&right_args, sizeof(Arguments)));
-        task_counter++;
-        color_index.push_back(make_pair(idx_left_sub_tree,idx_right_sub_tree-1));
-        color_index.push_back(make_pair(idx_right_sub_tree, idx_right_sub_tree +  static_cast<coord_t>(pow(2, max_depth - nx)) - 2) );
-    }
-    if( task_counter > 0 ){
-        IndexSpace is = lr.get_index_space();
-        DomainPointColoring coloring;
-        for( int i = 0 ; i < task_counter ; i++ ){
-            coloring[i]= Rect<1>(color_index[i].first,color_index[i].second);
+    vector<DomainPoint> launch_points;
+    vector<Arguments> light_args;
+    vector<LogicalRegion> light_regions;
+    vector<Future> light_frontiers;
+    for( size_t i = 0 ; i < frontier.entries.size(); i++ ){
+        coord_t level = frontier.entries[i].l;
+        int nx = frontier.entries[i].n;
+        coord_t estimate = estimate_subtree_nodes(frontier, max_depth - nx - 1, tile_height, args.grain);
+        for( int side = 0 ; side < 2 ; side++ ){
+            int position = child_tile_position(args.n, nx, level, side);
+            Arguments child_args( nx+1 , 2*level + side , args.max_depth, child_tile_idx(max_depth, args.n, args.idx, tile_height, position) , args.partition_color , args.actual_max_depth , args.tile_height);
+            child_args.gen = args.gen;
+            child_args.grain = args.grain;
+            child_args.refine_prob = args.refine_prob;
+            if( estimate < args.grain ){
+                LogicalRegion child = runtime->get_logical_subregion_by_color(ctx, lp, position + 1);
+                light_args.push_back(child_args);
+                light_regions.push_back(child);
+                light_frontiers.push_back(launch_refine_intra(runtime, ctx, child_args, child, lr));
+                continue;
+            }
+            arg_map.set_point( position + 1 , TaskArgument(&child_args,sizeof(Arguments)));
+            launch_points.push_back( DomainPoint(position + 1) );
         }
-        Rect<1>color_space = Rect<1>(0,task_counter-1);
-        IndexPartition ip = runtime->create_index_partition(ctx, is, color_space, coloring, DISJOINT_KIND, args.partition_color);
-        LogicalPartition lp = runtime->get_logical_partition(ctx, lr, ip);
-        Rect<1> launch_domain(0,task_counter-1);
-        IndexTaskLauncher refine_launcher(REFINE_INTER_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
-        refine_launcher.add_region_requirement(RegionRequirement(lp,0,WRITE_DISCARD, EXCLUSIVE, lr));
-        refine_launcher.add_field(0, FID_X);
+    }
+    if( !launch_points.empty() ){
+        IndexSpace launch_space = runtime->create_index_space(ctx, launch_points);
+        IndexTaskLauncher refine_launcher(REFINE_INTER_TASK_ID, launch_space, TaskArgument(NULL, 0), arg_map);
+        refine_launcher.tag = tile_launch_tag(args.n);
+        count_launch(launch_points.size());
+        refine_launcher.add_region_requirement(RegionRequirement(lp,0,WRITE_DISCARD, EXCLUSIVE, lr).add_flags(NO_ACCESS_FLAG));
+        refine_launcher.add_field(0, FID_COEFFS);
+        refine_launcher.add_field(0, FID_IS_LEAF);
         runtime->execute_index_space(ctx, refine_launcher);
+        runtime->destroy_index_space(ctx, launch_space);
     }
+    for( size_t i = 0 ; i < light_frontiers.size() ; i++ )
+        launch_refine_children(runtime, ctx, light_args[i], light_regions[i], lr, light_frontiers[i]);
 }
 
 
-void compress_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
-    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
-    : *(const Arguments *) task->args;
-    queue<Arguments>tree;
-    tree.push(args);
-    coord_t idx_left_sub_tree = 0LL;
-    coord_t idx_right_sub_tree = 0LL;
-    int max_depth = args.max_depth;
-    int tile_height = args.tile_height;
-    int helper_counter=0;
-    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > read_acc(regions[0], FID_X);
-    const FieldAccessor<WRITE_DISCARD,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > write_acc(regions[1], FID_X);
-    while(!tree.empty()){
-        Arguments temp = tree.front();
-        tree.pop();
-        int n = temp.n;
-        int l = temp.l;
-        coord_t idx = temp.idx;
-        idx_left_sub_tree = idx+1;
-        idx_right_sub_tree = idx + static_cast<coord_t>(pow(2, max_depth - n));
-        write_acc[helper_counter].level = l;
-        write_acc[helper_counter].idx = idx;
-        write_acc[helper_counter].n = n;
-        write_acc[helper_counter].is_valid_entry = true;
-        if( ((n % tile_height ) ==( tile_height-1 ) && ( !read_acc[idx].is_leaf ) ) )
-            write_acc[helper_counter].launch = true;
-        else if( !read_acc[idx].is_leaf ){
-                Arguments for_left_sub_tree (n + 1, l * 2    , max_depth, idx_left_sub_tree, temp.partition_color, temp.actual_max_depth, tile_height);
-                Arguments for_right_sub_tree(n + 1, l * 2 + 1, max_depth, idx_right_sub_tree, temp.partition_color, temp.actual_max_depth, tile_height);
-                tree.push( for_left_sub_tree );
-                tree.push( for_right_sub_tree );
+// Compresses a tile bottom-up. The child tiles are done by then, and their root values come in
+// the order of the frontier, two per frontier node.
+struct CompressVisitor{
+    static const bool post_order = true;
+    const TreeAccessor<READ_WRITE,READ_ONLY> &write_acc;
+    const Coefficients *child_values;
+    double sum_squares;
+    CompressVisitor( const TreeAccessor<READ_WRITE,READ_ONLY> &_write_acc, const Coefficients *_child_values ) : write_acc(_write_acc), child_values(_child_values), sum_squares(0.0) {}
+    void prefetch(coord_t idx) const {
+        prefetch_coeffs(write_acc.coeffs, idx);
+    }
+    bool visit(FrontierEntry &node){
+        if( write_acc.is_leaf[node.idx] ){
+            sum_squares = sum_squares + dot_coeffs(write_acc.coeffs[node.idx].c, write_acc.coeffs[node.idx].c, NUM_COEFFS);
+            return false;
         }
-        helper_counter++;
+        return true;
     }
-}
+    void frontier(const FrontierEntry &node){
+        const Coefficients &left = *child_values++;
+        const Coefficients &right = *child_values++;
+        double *value = write_acc.coeffs[node.idx].c;
+        add_coeffs(left.c, right.c, value, NUM_COEFFS);
+        sum_squares = sum_squares + dot_coeffs(value, value, NUM_COEFFS);
+    }
+    void leave(const FrontierEntry &node, const FrontierEntry &right){
+        coord_t idx = node.idx;
+        double *value = write_acc.coeffs[idx].c;
+        add_coeffs(write_acc.coeffs[left_child(idx)].c, write_acc.coeffs[right.idx].c, value, NUM_COEFFS);
+        sum_squares = sum_squares + dot_coeffs(value, value, NUM_COEFFS);
+    }
+};
 
+// One tile of a compress level launch (see tree_compress). Regions: 0 the tile block, 1 the plan
+// entry, 2 the entry's FID_TILE_VALUE, which the parent tile reads, then the values of the child
+// tiles when the level has a level below it, and last the accumulator when there is one. Only
+// tiles whose plan entry has children read the child values.
+void compress_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    Arguments args = plan_arguments(task, regions[1]);
+    TaskProbe probe(runtime, ctx, task->task_id);
+    TilePlan tile = plan_entry(task, regions[1]);
+    const TreeAccessor<READ_WRITE,READ_ONLY> write_acc(regions[0]);
+    const Coefficients *child_values = NULL;
+    if( tile.children > 0 ){
+        const FieldAccessor<READ_ONLY,Coefficients,1,coord_t,Realm::AffineAccessor<Coefficients,1,coord_t> > values(regions[3], FID_TILE_VALUE);
+        child_values = values.ptr(Rect<1>(tile.first_child, tile.first_child + tile.children - 1));
+    }
+    CompressVisitor visitor(write_acc, child_values);
+    walk_tile(args.max_depth, args.tile_height, FrontierEntry(args.n, args.l, args.idx), visitor);
+    const FieldAccessor<WRITE_DISCARD,Coefficients,1,coord_t,Realm::AffineAccessor<Coefficients,1,coord_t> > value(regions[2], FID_TILE_VALUE);
+    value[task->index_point[0]] = write_acc.coeffs[args.idx];
+    if( task->regions.back().privilege == REDUCE )
+        add_sum(regions.back(), 0, visitor.sum_squares);
+}
 
-void compress_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
-    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
-    : *(const Arguments *) task->args;
-    int tile_height = args.tile_height;
-    LogicalRegion lr = regions[0].get_logical_region();
-    Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height)-1));
-    IndexSpace is = runtime->create_index_space(ctx, helper_Array);
-    FieldSpace fs = runtime->create_field_space(ctx);
-    {
-        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
-        allocator.allocate_field(sizeof(HelperArgs), FID_X);
-    }
-    LogicalRegion new_helper_Region = runtime->create_logical_region(ctx, is, fs);
-    TaskLauncher compress_intra_launcher(COMPRESS_INTRA_TASK_ID, TaskArgument(&args, sizeof(Arguments)));
-    RegionRequirement req1(lr, READ_ONLY, EXCLUSIVE, lr);
-    RegionRequirement req2(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
-    req1.add_field(FID_X);
-    req2.add_field(FID_X);
-    compress_intra_launcher.add_region_requirement( req1 );
-    compress_intra_launcher.add_region_requirement( req2 );
-    runtime->execute_task(ctx,compress_intra_launcher);
-    PhysicalRegion physicalRegion = runtime->map_region( ctx, req2 );
-    const FieldAccessor<READ_ONLY,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > read_acc(physicalRegion, FID_X);
-    ArgumentMap arg_map;
-    int task_counter=0;
-    for( int  i = 0 ; i < (1<<tile_height) ; i++){
-        bool launch = read_acc[i].launch;
-        coord_t idx = read_acc[i].idx;
-        int level = read_acc[i].level;
-        int nx = read_acc[i].n;
-        if( launch ){
-            coord_t idx_left_sub_tree = idx+1;
-            coord_t idx_right_sub_tree = idx+ static_cast<coord_t>(pow(2, args.max_depth - nx ));
-            Arguments left_args( nx + 1 , 2*level , args.max_depth, idx_left_sub_tree , args.partition_color , args.actual_max_depth , args.tile_height);
-            Arguments right_args( nx + 1 , 2*level+1 , args.max_depth, idx_right_sub_tree , args.partition_color, args.actual_max_depth, args.tile_height);
-            arg_map.set_point( task_counter , TaskArgument(&left_args,sizeof(Arguments)));
-            task_counter++;
-            arg_map.set_point( task_counter, TaskArgument(&right_args, sizeof(Arguments)));
-            task_counter++;
+// pass[r] is the share the interior node at relative depth r of the walk hands to its children,
+// which add it to their own value when they are visited.
+struct ReconstructVisitor : public PreOrderVisitor{
+    const TreeAccessor<READ_WRITE,READ_ONLY> &tree_acc;
+    int tile_root;
+    Frontier &result;
+    Coefficients pass[MAX_TILE_HEIGHT];
+    ReconstructVisitor( const TreeAccessor<READ_WRITE,READ_ONLY> &_tree_acc, int _tile_root, Frontier &_result ) : tree_acc(_tree_acc), tile_root(_tile_root), result(_result) {}
+    void prefetch(coord_t idx) const {
+        prefetch_coeffs(tree_acc.coeffs, idx);
+    }
+    // Leaves are final once visited, since they take their parent's share first.
+    bool visit(FrontierEntry &node){
+        coord_t idx = node.idx;
+        int r = node.n - tile_root;
+        if( r > 0 )
+            add_coeffs(tree_acc.coeffs[idx].c, pass[r-1].c, tree_acc.coeffs[idx].c, NUM_COEFFS);
+        if( tree_acc.is_leaf[idx] ){
+            result.sum_squares = result.sum_squares + dot_coeffs(tree_acc.coeffs[idx].c, tree_acc.coeffs[idx].c, NUM_COEFFS);
+            return false;
         }
+        scale_coeffs(0.5, tree_acc.coeffs[idx].c, pass[r].c, NUM_COEFFS);
+        tree_acc.coeffs[idx] = Coefficients();
+        return true;
     }
-    if( task_counter > 0 ){
-        LogicalPartition lp = runtime->get_logical_partition_by_color(ctx, lr, args.partition_color);
-        Rect<1> launch_domain(0,task_counter-1);
-        IndexTaskLauncher compress_launcher(COMPRESS_INTER_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
-        compress_launcher.add_region_requirement(RegionRequirement(lp,0,WRITE_DISCARD, EXCLUSIVE, lr));
-        compress_launcher.add_field(0, FID_X);
-        runtime->execute_index_space(ctx, compress_launcher);
+    void frontier(const FrontierEntry &node){
+        result.entries.push_back(node);
+        result.passes.push_back(FrontierPass(pass[node.n - tile_root], false, false));
     }
-    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > write_acc(regions[0], FID_X);
-    for( int i = (1<<tile_height)-1; i>=0 ; i-- ){
-        if( !read_acc[i].is_valid_entry )
-            continue;
-        coord_t idx = read_acc[i].idx;
-        if( write_acc[idx].is_leaf )
-            continue;
-        int nx = read_acc[i].n;
-        coord_t idx_left_sub_tree = idx+1;
-        coord_t idx_right_sub_tree = idx + static_cast<coord_t>(pow(2, args.max_depth - nx));
-        write_acc[idx].value = write_acc[idx_left_sub_tree].value + write_acc[idx_right_sub_tree].value;
+};
+
+// One tile of a reconstruct level launch (see tree_reconstruct). Regions: 0 the tile block, 1 the
+// plan entry with the pass from the parent tile, then the passes of the child tiles when the
+// level has a level below it, and last the accumulator.
+void reconstruct_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    Arguments args = plan_arguments(task, regions[1]);
+    TaskProbe probe(runtime, ctx, task->task_id);
+    TilePlan tile = plan_entry(task, regions[1]);
+    Frontier frontier;
+    const TreeAccessor<READ_WRITE,READ_ONLY> tree_acc(regions[0]);
+    FrontierPass pass = plan_pass(task, regions[1], FID_TILE_PASS);
+    add_coeffs(tree_acc.coeffs[args.idx].c, pass.pass.c, tree_acc.coeffs[args.idx].c, NUM_COEFFS);
+    ReconstructVisitor visitor(tree_acc, args.n, frontier);
+    walk_tile(args.max_depth, args.tile_height, FrontierEntry(args.n, args.l, args.idx), visitor);
+    if( tile.children > 0 )
+        write_child_passes(regions[2], FID_TILE_PASS, tile, frontier);
+    add_sum(regions.back(), 0, frontier.sum_squares);
+}
+
+struct NormVisitor : public PreOrderVisitor{
+    const TreeAccessor<READ_ONLY,READ_ONLY> &tree_acc;
+    double sum_squares;
+    NormVisitor( const TreeAccessor<READ_ONLY,READ_ONLY> &_tree_acc ) : tree_acc(_tree_acc), sum_squares(0.0) {}
+    void prefetch(coord_t idx) const {
+        prefetch_coeffs(tree_acc.coeffs, idx);
     }
+    bool visit(FrontierEntry &node){
+        sum_squares = sum_squares + dot_coeffs(tree_acc.coeffs[node.idx].c, tree_acc.coeffs[node.idx].c, NUM_COEFFS);
+        return !tree_acc.is_leaf[node.idx];
+    }
+    void frontier(const FrontierEntry &node) {}
+};
+
+void norm_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    Arguments args = plan_arguments(task, regions[1]);
+    TaskProbe probe(runtime, ctx, task->task_id);
+    const TreeAccessor<READ_ONLY,READ_ONLY> tree_acc(regions[0]);
+    NormVisitor visitor(tree_acc);
+    walk_tile(args.max_depth, args.tile_height, FrontierEntry(args.n, args.l, args.idx), visitor);
+    add_sum(regions[2], 0, visitor.sum_squares);
 }
 
-void reconstruct_intra_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
-    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
-    : *(const Arguments *) task->args;
-    queue<Arguments>tree;
-    tree.push(args);
-    LogicalRegion lr = regions[0].get_logical_region();
-    LogicalPartition lp = LogicalPartition::NO_PART;
-    LogicalRegion my_sub_tree_lr = lr;
-    coord_t idx_left_sub_tree = 0LL;
-    coord_t idx_right_sub_tree = 0LL;
-    int max_depth = args.max_depth;
-    int tile_height = args.tile_height;
-    int helper_counter=0;
-    const FieldAccessor<WRITE_DISCARD,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > helper_acc(regions[1], FID_X);
-    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree_acc(regions[0], FID_X);
-    while(!tree.empty()){
-        Arguments temp = tree.front();
-        tree.pop();
-        int n = temp.n;
-        int l = temp.l;
-        coord_t idx = temp.idx;
-        idx_left_sub_tree = idx+1;
-        idx_right_sub_tree = idx + static_cast<coord_t>(pow(2, max_depth - n));
-        if( tree_acc[idx].is_leaf )
-            continue;
-        int pass = tree_acc[idx].value/2;
-        tree_acc[idx].value = 0;
-        tree_acc[idx_left_sub_tree].value = tree_acc[idx_left_sub_tree].value + pass;
-        tree_acc[idx_right_sub_tree].value = tree_acc[idx_right_sub_tree].value + pass;
-        if( (n % tile_height )==( tile_height-1 ) ){
-            helper_acc[helper_counter].n = n;
-            helper_acc[helper_counter].idx = idx;
-            helper_acc[helper_counter].level = l;
-            helper_acc[helper_counter].launch = true;
-            helper_counter++;
-        }
-        else{
-            Arguments for_left_sub_tree (n + 1, l * 2    , max_depth, idx_left_sub_tree, temp.partition_color, temp.actual_max_depth, tile_height);
-            Arguments for_right_sub_tree(n + 1, l * 2 + 1, max_depth, idx_right_sub_tree, temp.partition_color, temp.actual_max_depth, tile_height);
-            tree.push( for_left_sub_tree );
-            tree.push( for_right_sub_tree );
-        }
+
+struct ProductVisitor : public PreOrderVisitor{
+    const TreeAccessor<READ_ONLY,READ_ONLY> &tree1;
+    const TreeAccessor<READ_ONLY,READ_ONLY> &tree2;
+    double sum;
+    ProductVisitor( const TreeAccessor<READ_ONLY,READ_ONLY> &_tree1, const TreeAccessor<READ_ONLY,READ_ONLY> &_tree2 ) : tree1(_tree1), tree2(_tree2), sum(0.0) {}
+    void prefetch(coord_t idx) const {
+        prefetch_coeffs(tree1.coeffs, idx);
+        prefetch_coeffs(tree2.coeffs, idx);
+    }
+    bool visit(FrontierEntry &node){
+        sum = sum + dot_coeffs(tree1.coeffs[node.idx].c, tree2.coeffs[node.idx].c, NUM_COEFFS);
+        return !( tree1.is_leaf[node.idx] || tree2.is_leaf[node.idx] );
     }
+    void frontier(const FrontierEntry &node) {}
+};
+
+// Inner product of one tile, shared by product_task and the batched inner product.
+double product_tile(const PhysicalRegion &region1, const PhysicalRegion &region2, int max_depth, int tile_height, const FrontierEntry &root){
+    const TreeAccessor<READ_ONLY,READ_ONLY> tree1(region1);
+    const TreeAccessor<READ_ONLY,READ_ONLY> tree2(region2);
+    coord_t extent = tile_extent(max_depth, root.n, tile_height);
+    Rect<1> block(root.idx, root.idx + extent - 1);
+    if( same_structure(tree1.is_leaf.ptr(block), tree2.is_leaf.ptr(block), extent) )
+        return dot_coeffs(tree1.coeffs.ptr(block)->c, tree2.coeffs.ptr(block)->c, extent * NUM_COEFFS);
+    ProductVisitor visitor(tree1, tree2);
+    walk_tile(max_depth, tile_height, root, visitor);
+    return visitor.sum;
 }
 
-void reconstruct_inter_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
-    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
-    : *(const Arguments *) task->args;
-    int tile_height = args.tile_height;
-    LogicalRegion lr = regions[0].get_logical_region();
-    int max_depth = args.max_depth;
-    Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height-1)));
-    IndexSpace is = runtime->create_index_space(ctx, helper_Array);
-    FieldSpace fs = runtime->create_field_space(ctx);
-    {
-        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
-        allocator.allocate_field(sizeof(HelperArgs), FID_X);
-    }
-    LogicalRegion new_helper_Region = runtime->create_logical_region(ctx, is, fs);
-    TaskLauncher reconstruct_intra_launcher(RECONSTRUCT_INTRA_TASK_ID, TaskArgument(&args, sizeof(Arguments) ) );
-    RegionRequirement req1(lr, WRITE_DISCARD, EXCLUSIVE, lr);
-    RegionRequirement req2(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
-    req1.add_field(FID_X);
-    req2.add_field(FID_X);
-    reconstruct_intra_launcher.add_region_requirement(req1);
-    reconstruct_intra_launcher.add_region_requirement(req2);
-    runtime->execute_task(ctx,reconstruct_intra_launcher);
-    ArgumentMap arg_map;
-    PhysicalRegion physicalRegion = runtime->map_region( ctx, req2 );
-    const FieldAccessor<READ_ONLY,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > read_acc(physicalRegion, FID_X);
-    int task_counter=0;
-    for( int i = 0 ; i < (1<<(tile_height-1)); i++ ){
-        if(!read_acc[i].launch)
-            break;
-        coord_t idx = read_acc[i].idx;
-        int level = read_acc[i].level;
-        int nx = read_acc[i].n;
-        coord_t idx_left_sub_tree = idx+1;
-        coord_t idx_right_sub_tree = idx+ static_cast<coord_t>(pow(2, max_depth - nx));
-        Arguments left_args( nx+1 , 2*level , args.max_depth, idx_left_sub_tree , args.partition_color , args.actual_max_depth , args.tile_height);
-        Arguments right_args( nx+1 , 2*level+1 , args.max_depth, idx_right_sub_tree , args.partition_color, args.actual_max_depth, args.tile_height);
-        arg_map.set_point( task_counter , TaskArgument(&left_args,sizeof(Arguments)));
-        task_counter++;
-        arg_map.set_point( task_counter, TaskArgument(&right_args, sizeof(Arguments)));
-        task_counter++;
-    }
-    if( task_counter > 0 ){
-        LogicalPartition lp = runtime->get_logical_partition_by_color(ctx, lr, args.partition_color);
-        Rect<1> launch_domain(0,task_counter-1);
-        IndexTaskLauncher reconstruct_launcher(RECONSTRUCT_INTER_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
-        reconstruct_launcher.add_region_requirement(RegionRequirement(lp,0,WRITE_DISCARD, EXCLUSIVE, lr));
-        reconstruct_launcher.add_field(0, FID_X);
-        runtime->execute_index_space(ctx, reconstruct_launcher);
+void product_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    Arguments args = plan_arguments(task, regions[1]);
+    TaskProbe probe(runtime, ctx, task->task_id);
+    double result = product_tile(regions[0], regions[2], args.max_depth, args.tile_height, FrontierEntry(args.n, args.l, args.idx));
+    add_sum(regions[3], 0, result);
+}
+
+// Batched form of write_child_passes for tuple k, whose frontier covers only the child tiles its
+// result has. They are found by position among the child entries in tiles.
+void write_batch_child_passes(const PhysicalRegion &tiles, const PhysicalRegion &children, FieldID field, const TilePlan &tile, int tile_height, const Frontier &frontier){
+    const FieldAccessor<READ_ONLY,TilePlan,1,coord_t,Realm::AffineAccessor<TilePlan,1,coord_t> > entries(tiles, FID_TILE);
+    const FieldAccessor<WRITE_DISCARD,FrontierPass,1,coord_t,Realm::AffineAccessor<FrontierPass,1,coord_t> > passes(children, field);
+    vector<int> positions = frontier_positions(frontier, tile.n);
+    size_t next = 0;
+    for( coord_t c = tile.first_child ; c < tile.first_child + tile.children ; c++ ){
+        coord_t position = entries[c].l - (tile.l << tile_height);
+        if( next < positions.size() && positions[next] == position )
+            passes[c] = frontier.passes[next++ / 2];
     }
 }
 
-int norm_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
-    Arguments args = task->is_index_space ? *(const Arguments *) task->local_args
-    : *(const Arguments *) task->args;
-    int tile_height = args.tile_height;
-    LogicalRegion lr = regions[0].get_logical_region();
-    int max_depth = args.max_depth;
-    Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height-1)));
-    IndexSpace is = runtime->create_index_space(ctx, helper_Array);
-    FieldSpace fs = runtime->create_field_space(ctx);
-    {
-        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
-        allocator.allocate_field(sizeof(HelperArgs), FID_X);
-    }
-    LogicalRegion new_helper_Region = runtime->create_logical_region(ctx, is, fs);
-    RegionRequirement req(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
-    req.add_field(FID_X);
-    PhysicalRegion physicalRegion = runtime->map_region( ctx, req );
-    const FieldAccessor<WRITE_DISCARD,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > helper_acc(physicalRegion, FID_X);
-    const FieldAccessor<WRITE_DISCARD,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree_acc(regions[0], FID_X);
-    int result=0;
-    queue<Arguments>tree;
-    tree.push(args);
-    int helper_counter = 0;
-    while(!tree.empty()){
-        Arguments temp = tree.front();
-        tree.pop();
-        int n = temp.n;
-        int l = temp.l;
-        coord_t idx = temp.idx;
-        coord_t idx_left_sub_tree = idx+1;
-        coord_t idx_right_sub_tree = idx + static_cast<coord_t>(pow(2, max_depth - n));
-        result = result + tree_acc[idx].value*tree_acc[idx].value;
-        if( tree_acc[idx].is_leaf )
+// One tile of a batched gaxpy level launch (see gaxpy_batch). Regions: 0 the plan entry with a
+// pass per tuple, then the blocks of tree1, tree2 and tree3 of every tuple, and when the level
+// has a level below it the child entries and their passes. A tuple whose result lacks the tile
+// has empty blocks and is skipped.
+void gaxpy_batch_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    const BatchGaxpyArgs &batch = *(const BatchGaxpyArgs *) task->args;
+    TaskProbe probe(runtime, ctx, task->task_id);
+    TilePlan tile = plan_entry(task, regions[0]);
+    for( int k = 0 ; k < batch.count ; k++ ){
+        if( !(tile.operands & (1u << k)) )
             continue;
-        if( (n% tile_height )==( tile_height - 1)){
-            helper_acc[helper_counter].n = n;
-            helper_acc[helper_counter].level =l;
-            helper_acc[helper_counter].idx = idx;
-            helper_acc[helper_counter].launch = true;
-            helper_counter++;
+        FrontierPass pass = plan_pass(task, regions[0], FID_TILE_PASS + k);
+        GaxpyArgs args(tile.n, tile.l, batch.max_depth, tile.idx, pass.pass, pass.left_null, pass.right_null, batch.actual_max_depth, batch.tile_height, batch.alpha[k], batch.beta[k]);
+        Frontier frontier = gaxpy_tile(args, regions[3*k+1], regions[3*k+2], regions[3*k+3]);
+        if( tile.children > 0 )
+            write_batch_child_passes(regions[3*batch.count+1], regions[3*batch.count+2], FID_TILE_PASS + k, tile, batch.tile_height, frontier);
+    }
+}
+
+// Requirement 0 is the plan entry, then come the blocks of the two trees of every pair and last
+// the accumulator. A pair that does not reach the tile has empty blocks here.
+void inner_product_batch_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
+    Arguments args = plan_arguments(task, regions[0]);
+    TaskProbe probe(runtime, ctx, task->task_id);
+    unsigned operands = plan_entry(task, regions[0]).operands;
+    int count = static_cast<int>(regions.size() - 2) / 2;
+    for( int k = 0 ; k < count ; k++ )
+        if( operands & (1u << k) )
+            add_sum(regions.back(), k, product_tile(regions[2*k+1], regions[2*k+2], args.max_depth, args.tile_height, FrontierEntry(args.n, args.l, args.idx)));
+}
+
+// Mapper for the tile tasks. LOC_PROCs are grouped by the memory closest to them (the socket
+// memory when the machine has one, the system memory otherwise). The points of a refine launch
+// are children of one tile, so they stay in the group of the processor that launched them and are
+// dealt over its processors by position; only the launch below the root tile spreads over all
+// groups. Every other tile task is launched per plan level, and those launches are cut into
+// contiguous runs of tiles, one per processor, taken group by group, so the blocks a tile reads
+// from each tree of a gaxpy or product land on the same processor. Each tile block gets one
+// instance per group memory, covering that block only, which every later task and inline mapping
+// of the block reuses; accumulators get a fresh reduction instance and empty blocks a virtual
+// one.
+class TileMapper : public Mapping::DefaultMapper{
+public:
+    TileMapper(Mapping::MapperRuntime *rt, Machine machine, Processor local);
+    virtual void select_task_options(const Mapping::MapperContext ctx, const Task &task, TaskOptions &output);
+    virtual void slice_task(const Mapping::MapperContext ctx, const Task &task, const SliceTaskInput &input, SliceTaskOutput &output);
+    virtual void map_task(const Mapping::MapperContext ctx, const Task &task, const MapTaskInput &input, MapTaskOutput &output);
+    virtual void map_inline(const Mapping::MapperContext ctx, const InlineMapping &inline_op, const MapInlineInput &input, MapInlineOutput &output);
+    virtual void select_steal_targets(const Mapping::MapperContext ctx, const SelectStealingInput &input, SelectStealingOutput &output);
+    virtual void permit_steal_request(const Mapping::MapperContext ctx, const StealRequestInput &input, StealRequestOutput &output);
+private:
+    bool is_tile_task(TaskID task_id) const;
+    bool block_instance(const Mapping::MapperContext ctx, const RegionRequirement &req, Memory memory, Mapping::PhysicalInstance &instance);
+    bool reduction_instance(const Mapping::MapperContext ctx, const RegionRequirement &req, Memory memory, Mapping::PhysicalInstance &instance);
+    std::vector<std::vector<Processor> > groups;
+    std::vector<Processor> ordered_procs;    // every group's processors, one group after another
+    std::vector<Memory> group_memories;
+    std::map<Processor, size_t> group_of;
+};
+
+static Memory closest_memory(Machine machine, Processor proc){
+    Machine::MemoryQuery socket_mems(machine);
+    socket_mems.only_kind(Memory::SOCKET_MEM).has_affinity_to(proc);
+    if( socket_mems.count() > 0 )
+        return socket_mems.first();
+    Machine::MemoryQuery system_mems(machine);
+    system_mems.only_kind(Memory::SYSTEM_MEM).has_affinity_to(proc);
+    return system_mems.first();
+}
+
+TileMapper::TileMapper(Mapping::MapperRuntime *rt, Machine machine, Processor local)
+    : DefaultMapper(rt, machine, local, "tile_mapper"){
+    Machine::ProcessorQuery procs(machine);
+    procs.only_kind(Processor::LOC_PROC);
+    for( Machine::ProcessorQuery::iterator it = procs.begin() ; it != procs.end() ; it++ ){
+        Memory memory = closest_memory(machine, *it);
+        size_t group = std::find(group_memories.begin(), group_memories.end(), memory) - group_memories.begin();
+        if( group == group_memories.size() ){
+            group_memories.push_back(memory);
+            groups.push_back(std::vector<Processor>());
         }
-        else{
-            Arguments for_left_sub_tree (n + 1, l * 2    , max_depth, idx_left_sub_tree, temp.partition_color, temp.actual_max_depth, tile_height);
-            Arguments for_right_sub_tree(n + 1, l * 2 + 1, max_depth, idx_right_sub_tree, temp.partition_color, temp.actual_max_depth, tile_height);
-            tree.push( for_left_sub_tree );
-            tree.push( for_right_sub_tree );
+        groups[group].push_back(*it);
+        group_of[*it] = group;
+    }
+    for( size_t group = 0 ; group < groups.size() ; group++ )
+        ordered_procs.insert(ordered_procs.end(), groups[group].begin(), groups[group].end());
+}
+
+bool TileMapper::is_tile_task(TaskID task_id) const {
+    return task_id != TOP_LEVEL_TASK_ID;
+}
+
+void TileMapper::select_task_options(const Mapping::MapperContext ctx, const Task &task, TaskOptions &output){
+    if( !is_tile_task(task.task_id) ){
+        DefaultMapper::select_task_options(ctx, task, output);
+        return;
+    }
+    output.initial_proc = local_proc;
+    output.inline_task = false;
+    output.stealable = false;
+    output.map_locally = !task.is_index_space;
+}
+
+void TileMapper::slice_task(const Mapping::MapperContext ctx, const Task &task, const SliceTaskInput &input, SliceTaskOutput &output){
+    if( !is_tile_task(task.task_id) ){
+        DefaultMapper::slice_task(ctx, task, input, output);
+        return;
+    }
+    if( task.tag & TILE_LEVEL_TAG ){
+        Rect<1> rect = input.domain;
+        coord_t total = rect.volume();
+        coord_t procs = ordered_procs.size();
+        for( coord_t p = 0 ; p < procs ; p++ ){
+            coord_t lo = rect.lo[0] + total * p / procs;
+            coord_t hi = rect.lo[0] + total * (p + 1) / procs - 1;
+            if( lo <= hi )
+                output.slices.push_back(TaskSlice(Domain(Rect<1>(lo, hi)), ordered_procs[p], false, false));
         }
+        return;
     }
-    int task_counter =0;
-    ArgumentMap arg_map;
-    for( int i = 0 ; i < helper_counter ; i++ ){
-        coord_t idx = helper_acc[i].idx;
-        int level = helper_acc[i].level;
-        int nx = helper_acc[i].n;
-        coord_t idx_left_sub_tree = idx+1;
-        coord_t idx_right_sub_tree = idx+ static_cast<coord_t>(pow(2, max_depth - nx));
-        Arguments left_args( nx+1 , 2*level , args.max_depth, idx_left_sub_tree , args.partition_color , args.actual_max_depth , args.tile_height);
-        Arguments right_args( nx+1 , 2*level+1 , args.max_depth, idx_right_sub_tree , args.partition_color, args.actual_max_depth, args.tile_height);
-        arg_map.set_point( task_counter , TaskArgument(&left_args,sizeof(Arguments)));
-        task_counter++;
-        arg_map.set_point( task_counter, TaskArgument(&right_args, sizeof(Arguments)));
-        task_counter++;
-    }
-    if( task_counter > 0 ){
-        LogicalPartition lp = runtime->get_logical_partition_by_color(ctx, lr, args.partition_color);
-        Rect<1> launch_domain(0,task_counter-1);
-        IndexTaskLauncher norm_launcher(NORM_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
-        norm_launcher.add_region_requirement(RegionRequirement(lp,0,WRITE_DISCARD, EXCLUSIVE, lr));
-        norm_launcher.add_field(0, FID_X);
-        FutureMap f_result = runtime->execute_index_space(ctx, norm_launcher);
-        for( int i = 0 ; i < task_counter ; i++ )
-            result = result + f_result.get_result<int>(i);
+    bool spread = (task.tag & TILE_SPREAD_TAG) != 0;
+    size_t home = group_of[local_proc];
+    for( Domain::DomainPointIterator it(input.domain) ; it ; it++ ){
+        coord_t position = it.p[0];
+        const std::vector<Processor> &group = spread ? groups[position % groups.size()] : groups[home];
+        coord_t slot = spread ? position / groups.size() : position;
+        output.slices.push_back(TaskSlice(Domain(it.p, it.p), group[slot % group.size()], false, task.task_id == REFINE_INTER_TASK_ID));
     }
-    return result;
 }
 
+// The instance of the tile block req.region in memory, with every field, so that tasks using
+// either field share it. Instances cover a block only: their total size follows the number of
+// tiles refinement made, not the extent of the tree's index space.
+bool TileMapper::block_instance(const Mapping::MapperContext ctx, const RegionRequirement &req, Memory memory, Mapping::PhysicalInstance &instance){
+    std::vector<FieldID> fields;
+    runtime->get_field_space_fields(ctx, req.region.get_field_space(), fields);
+    LayoutConstraintSet constraints;
+    constraints.add_constraint(FieldConstraint(fields, false, false))
+               .add_constraint(MemoryConstraint(memory.kind()));
+    std::vector<LogicalRegion> regions(1, req.region);
+    bool created;
+    return runtime->find_or_create_physical_instance(ctx, memory, constraints, regions, instance, created, true, 0, true);
+}
 
-int product_task(const Task *task, const std::vector<PhysicalRegion> &regions, Context ctx, HighLevelRuntime *runtime){
-    InnerProductArgs args = task->is_index_space ? *(const InnerProductArgs *) task->local_args
-    : *(const InnerProductArgs *) task->args;
-    int tile_height = args.tile_height;
-    int max_depth = args.max_depth;
-    LogicalRegion lr1 = regions[0].get_logical_region();
-    LogicalRegion lr2 = regions[1].get_logical_region();
-    Rect<1> helper_Array(0LL, static_cast<coord_t>(pow(2, tile_height-1)));
-    IndexSpace is = runtime->create_index_space(ctx, helper_Array);
-    FieldSpace fs = runtime->create_field_space(ctx);
-    {
-        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
-        allocator.allocate_field(sizeof(HelperArgs), FID_X);
-    }
-    LogicalRegion new_helper_Region = runtime->create_logical_region(ctx, is, fs);
-    RegionRequirement req(new_helper_Region, WRITE_DISCARD, EXCLUSIVE, new_helper_Region);
-    req.add_field(FID_X);
-    PhysicalRegion physicalRegion = runtime->map_region( ctx, req );
-    const FieldAccessor<WRITE_DISCARD,HelperArgs,1,coord_t,Realm::AffineAccessor<HelperArgs,1,coord_t> > helper_acc(physicalRegion, FID_X);
-    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree1(regions[0], FID_X);
-    const FieldAccessor<READ_ONLY,TreeArgs,1,coord_t,Realm::AffineAccessor<TreeArgs,1,coord_t> > tree2(regions[1], FID_X);
-    queue<InnerProductArgs>tree;
-    tree.push(args);
-    int result = 0;
-    int helper_counter=0;
-    while(!tree.empty()){
-        InnerProductArgs temp = tree.front();
-        tree.pop();
-        int n = temp.n;
-        int l = temp.l;
-        coord_t idx = temp.idx;
-        coord_t idx_left_sub_tree = idx+1;
-        coord_t idx_right_sub_tree = idx + static_cast<coord_t>(pow(2, max_depth - n));
-        bool leaf1 = tree1[idx].is_leaf;
-        bool leaf2 = tree2[idx].is_leaf;
-        result = result + tree1[idx].value*tree2[idx].value;
-        if(leaf1||leaf2)
+// A new instance folding req.redop into the fields of req, which Legion applies to the region
+// once the task is done.
+bool TileMapper::reduction_instance(const Mapping::MapperContext ctx, const RegionRequirement &req, Memory memory, Mapping::PhysicalInstance &instance){
+    std::vector<FieldID> fields(req.privilege_fields.begin(), req.privilege_fields.end());
+    LayoutConstraintSet constraints;
+    constraints.add_constraint(SpecializedConstraint(REDUCTION_FOLD_SPECIALIZE, req.redop))
+               .add_constraint(FieldConstraint(fields, false, false))
+               .add_constraint(MemoryConstraint(memory.kind()));
+    std::vector<LogicalRegion> regions(1, req.region);
+    return runtime->create_physical_instance(ctx, memory, constraints, regions, instance, true, 0, true);
+}
+
+void TileMapper::map_task(const Mapping::MapperContext ctx, const Task &task, const MapTaskInput &input, MapTaskOutput &output){
+    if( !is_tile_task(task.task_id) ){
+        DefaultMapper::map_task(ctx, task, input, output);
+        return;
+    }
+    Memory memory = group_memories[group_of[task.target_proc]];
+    output.chosen_variant = default_find_preferred_variant(task, ctx, true, true, Processor::LOC_PROC).variant;
+    output.task_priority = 0;
+    output.postmap_task = false;
+    output.target_procs.push_back(task.target_proc);
+    for( unsigned idx = 0 ; idx < task.regions.size() ; idx++ ){
+        const RegionRequirement &req = task.regions[idx];
+        if( (req.flags & NO_ACCESS_FLAG) || req.privilege_fields.empty() )
+            continue;
+        if( runtime->get_index_space_domain(ctx, req.region.get_index_space()).get_volume() == 0 ){
+            output.chosen_instances[idx].push_back(Mapping::PhysicalInstance::get_virtual_instance());
             continue;
-        if((n% tile_height )==( tile_height-1 )){
-            helper_acc[helper_counter].n = n;
-            helper_acc[helper_counter].level =l;
-            helper_acc[helper_counter].idx = idx;
-            helper_counter++;
-        }
-        else{
-            InnerProductArgs for_left_sub_tree (n + 1, l * 2    , max_depth, idx_left_sub_tree, temp.partition_color1, temp.partition_color2, temp.actual_max_depth, tile_height);
-            InnerProductArgs for_right_sub_tree(n + 1, l * 2 + 1, max_depth, idx_right_sub_tree, temp.partition_color1, temp.partition_color2 ,temp.actual_max_depth, tile_height);
-            tree.push( for_left_sub_tree );
-            tree.push( for_right_sub_tree );
         }
+        Mapping::PhysicalInstance instance;
+        bool mapped = req.privilege == REDUCE ? reduction_instance(ctx, req, memory, instance) : block_instance(ctx, req, memory, instance);
+        if( !mapped )
+            default_report_failed_instance_creation(task, idx, task.target_proc, memory);
+        output.chosen_instances[idx].push_back(instance);
     }
-    int task_counter =0;
-    ArgumentMap arg_map;
-    for( int i = 0 ; i < helper_counter ; i++ ){
-        coord_t idx = helper_acc[i].idx;
-        int level = helper_acc[i].level;
-        int nx = helper_acc[i].n;
-        coord_t idx_left_sub_tree = idx+1;
-        coord_t idx_right_sub_tree = idx+ static_cast<coord_t>(pow(2, max_depth - nx));
-        InnerProductArgs left_args( nx+1 , 2*level , args.max_depth, idx_left_sub_tree , args.partition_color1 , args.partition_color2, args.actual_max_depth , args.tile_height);
-        InnerProductArgs right_args( nx+1 , 2*level+1 , args.max_depth, idx_right_sub_tree , args.partition_color1, args.partition_color2 ,args.actual_max_depth, args.tile_height);
-        arg_map.set_point( task_counter , TaskArgument(&left_args,sizeof(Arguments)));
-        task_counter++;
-        arg_map.set_point( task_counter, TaskArgument(&right_args, sizeof(Arguments)));
-        task_counter++;
-    }
-    if( task_counter > 0 ){
-        LogicalPartition lp1 = runtime->get_logical_partition_by_color(ctx, lr1, args.partition_color1);
-        LogicalPartition lp2 = runtime->get_logical_partition_by_color(ctx, lr2, args.partition_color2);
-        Rect<1> launch_domain(0,task_counter-1);
-        IndexTaskLauncher product_launcher(INNER_PRODUCT_TASK_ID, launch_domain, TaskArgument(NULL, 0), arg_map);
-        product_launcher.add_region_requirement(RegionRequirement(lp1,0,READ_ONLY, EXCLUSIVE, lr1));
-        product_launcher.add_region_requirement(RegionRequirement(lp2,0,READ_ONLY, EXCLUSIVE, lr2));
-        product_launcher.add_field(0,FID_X);
-        product_launcher.add_field(1,FID_X);
-        FutureMap f_result = runtime->execute_index_space(ctx, product_launcher);
-        for( int i = 0 ; i < task_counter ; i++ )
-            result = result + f_result.get_result<int>(i);
+}
+
+// Inline mappings of a tile block reuse the instance its tasks map.
+void TileMapper::map_inline(const Mapping::MapperContext ctx, const InlineMapping &inline_op, const MapInlineInput &input, MapInlineOutput &output){
+    Memory memory = group_memories[group_of[local_proc]];
+    Mapping::PhysicalInstance instance;
+    if( !block_instance(ctx, inline_op.requirement, memory, instance) ){
+        DefaultMapper::map_inline(ctx, inline_op, input, output);
+        return;
     }
-    return result;
+    output.chosen_instances.push_back(instance);
+}
+
+// Refine points are stealable, since refinement is unbalanced. An idle processor asks the others
+// of its group first, whose blocks live in the same memory, and all processors only when its
+// group has no other.
+void TileMapper::select_steal_targets(const Mapping::MapperContext ctx, const SelectStealingInput &input, SelectStealingOutput &output){
+    const std::vector<Processor> &group = groups[group_of[local_proc]];
+    const std::vector<Processor> &candidates = group.size() > 1 ? group : local_cpus;
+    for( size_t i = 0 ; i < candidates.size() ; i++ )
+        if( !(candidates[i] == local_proc) && input.blacklist.find(candidates[i]) == input.blacklist.end() )
+            output.targets.insert(candidates[i]);
+}
+
+// Gives away half of the pending refine points, rounded up, so the victim keeps work for itself.
+// Rounding up lets a single pending point go: a thief only asks when it is idle, and the point
+// would otherwise sit queued behind whatever the victim is running.
+void TileMapper::permit_steal_request(const Mapping::MapperContext ctx, const StealRequestInput &input, StealRequestOutput &output){
+    size_t pending = 0;
+    for( size_t i = 0 ; i < input.stealable_tasks.size() ; i++ )
+        if( input.stealable_tasks[i]->task_id == REFINE_INTER_TASK_ID )
+            pending++;
+    for( size_t i = 0 ; i < input.stealable_tasks.size() && output.stolen_tasks.size() < (pending + 1) / 2 ; i++ )
+        if( input.stealable_tasks[i]->task_id == REFINE_INTER_TASK_ID )
+            output.stolen_tasks.insert(input.stealable_tasks[i]);
+}
+
+void update_mappers(Machine machine, HighLevelRuntime *runtime, const std::set<Processor> &local_procs){
+    assign_counter_slots(local_procs);
+    for( std::set<Processor>::const_iterator it = local_procs.begin() ; it != local_procs.end() ; it++ )
+        runtime->replace_default_mapper(new TileMapper(runtime->get_mapper_runtime(), machine, *it), *it);
 }
 
 int main(int argc, char** argv){
 
     Runtime::set_top_level_task_id(TOP_LEVEL_TASK_ID);
+    Runtime::add_registration_callback(update_mappers);
+
+    {
+        TaskVariantRegistrar registrar(TOP_LEVEL_TASK_ID, task_names[TOP_LEVEL_TASK_ID]);
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<top_level_task>(registrar, task_names[TOP_LEVEL_TASK_ID]);
+    }
+
+    {
+        TaskVariantRegistrar registrar(REFINE_INTER_TASK_ID, task_names[REFINE_INTER_TASK_ID]);
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<refine_inter_task>(registrar, task_names[REFINE_INTER_TASK_ID]);
+    }
+
+    {
+        TaskVariantRegistrar registrar(REFINE_INTRA_TASK_ID, task_names[REFINE_INTRA_TASK_ID]);
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<Frontier,refine_intra_task>(registrar, task_names[REFINE_INTRA_TASK_ID]);
+    }
+
+    {
+        TaskVariantRegistrar registrar(REFINE_CHILDREN_TASK_ID, task_names[REFINE_CHILDREN_TASK_ID]);
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<refine_children_task>(registrar, task_names[REFINE_CHILDREN_TASK_ID]);
+    }
 
     {
-        TaskVariantRegistrar registrar(TOP_LEVEL_TASK_ID, "top_level");
+        TaskVariantRegistrar registrar(DUMP_TASK_ID, task_names[DUMP_TASK_ID]);
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
-        Runtime::preregister_task_variant<top_level_task>(registrar, "top_level");
+        Runtime::preregister_task_variant<dump_task>(registrar, task_names[DUMP_TASK_ID]);
     }
 
     {
-        TaskVariantRegistrar registrar(REFINE_INTER_TASK_ID, "refine_inter");
+        TaskVariantRegistrar registrar(COMPRESS_TASK_ID, task_names[COMPRESS_TASK_ID]);
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
-        Runtime::preregister_task_variant<refine_inter_task>(registrar, "refine_inter");
+        Runtime::preregister_task_variant<compress_task>(registrar, task_names[COMPRESS_TASK_ID]);
     }
 
     {
-        TaskVariantRegistrar registrar(REFINE_INTRA_TASK_ID, "refine_intra");
+        TaskVariantRegistrar registrar(RECONSTRUCT_TASK_ID, task_names[RECONSTRUCT_TASK_ID]);
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
-        Runtime::preregister_task_variant<refine_intra_task>(registrar, "refine_intra");
+        Runtime::preregister_task_variant<reconstruct_task>(registrar, task_names[RECONSTRUCT_TASK_ID]);
     }
 
     {
-        TaskVariantRegistrar registrar(PRINT_TASK_ID, "print");
+        TaskVariantRegistrar registrar(NORM_TASK_ID, task_names[NORM_TASK_ID]);
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
-        Runtime::preregister_task_variant<print_task>(registrar, "print");
+        Runtime::preregister_task_variant<norm_task>(registrar, task_names[NORM_TASK_ID]);
     }
 
     {
-        TaskVariantRegistrar registrar(COMPRESS_INTER_TASK_ID, "compress_inter");
+        TaskVariantRegistrar registrar(INNER_PRODUCT_TASK_ID, task_names[INNER_PRODUCT_TASK_ID]);
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
-        Runtime::preregister_task_variant<compress_inter_task>(registrar, "compress_inter");
+        Runtime::preregister_task_variant<product_task>(registrar, task_names[INNER_PRODUCT_TASK_ID]);
     }
 
     {
-        TaskVariantRegistrar registrar(COMPRESS_INTRA_TASK_ID, "compress_intra");
+        TaskVariantRegistrar registrar(GAXPY_TASK_ID, task_names[GAXPY_TASK_ID]);
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
-        Runtime::preregister_task_variant<compress_intra_task>(registrar, "compress_intra");
+        Runtime::preregister_task_variant<gaxpy_task>(registrar, task_names[GAXPY_TASK_ID]);
     }
 
     {
-        TaskVariantRegistrar registrar(RECONSTRUCT_INTER_TASK_ID, "reconstruct_inter");
+        TaskVariantRegistrar registrar(RESTORE_TASK_ID, task_names[RESTORE_TASK_ID]);
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
-        Runtime::preregister_task_variant<reconstruct_inter_task>(registrar, "reconstruct_inter");
+        Runtime::preregister_task_variant<bool,restore_task>(registrar, task_names[RESTORE_TASK_ID]);
     }
 
     {
-        TaskVariantRegistrar registrar(RECONSTRUCT_INTRA_TASK_ID, "reconstruct_intra");
+        TaskVariantRegistrar registrar(GAXPY_BATCH_TASK_ID, task_names[GAXPY_BATCH_TASK_ID]);
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
-        Runtime::preregister_task_variant<reconstruct_intra_task>(registrar, "reconstruct_intra");
+        Runtime::preregister_task_variant<gaxpy_batch_task>(registrar, task_names[GAXPY_BATCH_TASK_ID]);
     }
 
     {
-        TaskVariantRegistrar registrar(NORM_TASK_ID, "norm_task");
+        TaskVariantRegistrar registrar(INNER_PRODUCT_BATCH_TASK_ID, task_names[INNER_PRODUCT_BATCH_TASK_ID]);
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
-        Runtime::preregister_task_variant<int,norm_task>(registrar, "norm_task");
+        Runtime::preregister_task_variant<inner_product_batch_task>(registrar, task_names[INNER_PRODUCT_BATCH_TASK_ID]);
     }
 
     {
-        TaskVariantRegistrar registrar(INNER_PRODUCT_TASK_ID, "inner_product_task");
+        TaskVariantRegistrar registrar(SUM_RESULT_TASK_ID, task_names[SUM_RESULT_TASK_ID]);
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
-        Runtime::preregister_task_variant<int,product_task>(registrar, "inner_product_task");
+        Runtime::preregister_task_variant<double,sum_result_task>(registrar, task_names[SUM_RESULT_TASK_ID]);
     }
 
     {
-        TaskVariantRegistrar registrar(GAXPY_INTRA_TASK_ID, "gaxpy_intra");
+        TaskVariantRegistrar registrar(BATCH_SUM_RESULT_TASK_ID, task_names[BATCH_SUM_RESULT_TASK_ID]);
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
-        Runtime::preregister_task_variant<gaxpy_intra_task>(registrar, "gaxpy_intra");
+        Runtime::preregister_task_variant<BatchSum,batch_sum_result_task>(registrar, task_names[BATCH_SUM_RESULT_TASK_ID]);
     }
 
     {
-        TaskVariantRegistrar registrar(GAXPY_INTER_TASK_ID, "gaxpy_inter");
+        TaskVariantRegistrar registrar(PLAN_TASK_ID, task_names[PLAN_TASK_ID]);
         registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
-        Runtime::preregister_task_variant<gaxpy_inter_task>(registrar, "gaxpy_inter");
+        Runtime::preregister_task_variant<Frontier,plan_task>(registrar, task_names[PLAN_TASK_ID]);
     }
 
+    Runtime::register_reduction_op<SumReduction>(SUM_REDOP_ID);
     return Runtime::start(argc,argv);
 }
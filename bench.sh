@@ -0,0 +1,28 @@
+#!/bin/sh
+# Throughput sweep for Tile_Madness (make bench): every operator over tree depth, tile height,
+# refinement probability and CPU count, one --bench run per point. Rows are appended to OUT.
+# Override any list from the environment, e.g.
+#   DEPTHS="10 14" TILES="2 4" PROBS="0.6" CPUS="1 8" FORMAT=json OUT=bench.json ./bench.sh
+
+BIN=${BIN:-./Tile_Madness}
+FORMAT=${FORMAT:-csv}
+OUT=${OUT:-bench.$FORMAT}
+DEPTHS=${DEPTHS:-"10 12 14"}
+TILES=${TILES:-"2 3 4"}
+PROBS=${PROBS:-"0.5 0.7 0.9"}
+CPUS=${CPUS:-"1 2 4"}
+WARMUP=${WARMUP:-1}
+REPS=${REPS:-5}
+SEED=${SEED:-12345}
+
+for cpus in $CPUS; do
+    for depth in $DEPTHS; do
+        for tile in $TILES; do
+            for prob in $PROBS; do
+                $BIN --bench -bench_format $FORMAT -bench_out $OUT -bench_warmup $WARMUP -bench_reps $REPS \
+                    -seed $SEED -max_depth $depth --tile $tile -refine_prob $prob -ll:cpu $cpus || exit 1
+            done
+        done
+    done
+done
+echo "results in $OUT"
@@ -0,0 +1,101 @@
+#ifndef LEAF_KERNELS_H
+#define LEAF_KERNELS_H
+
+// Kernels over the coefficient blocks of tree nodes. Each node carries k doubles, and a tile
+// block stores the blocks of its nodes back to back, so both a single node and a whole block
+// are contiguous arrays. Built for AVX-512 or AVX2 when the compiler targets them, with a
+// scalar loop for everything else and for the tails.
+
+#include <cstddef>
+#include <cstring>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// out = a + b
+inline void add_coeffs(const double *a, const double *b, double *out, size_t k){
+    size_t i = 0;
+#if defined(__AVX512F__)
+    for( ; i + 8 <= k ; i += 8 )
+        _mm512_storeu_pd(out + i, _mm512_add_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i)));
+#elif defined(__AVX2__)
+    for( ; i + 4 <= k ; i += 4 )
+        _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+#endif
+    for( ; i < k ; i++ )
+        out[i] = a[i] + b[i];
+}
+
+// out = alpha * a + beta * b; out may be a or b
+inline void axpby_coeffs(double alpha, const double *a, double beta, const double *b, double *out, size_t k){
+    size_t i = 0;
+#if defined(__AVX512F__)
+    __m512d va = _mm512_set1_pd(alpha);
+    __m512d vb = _mm512_set1_pd(beta);
+    for( ; i + 8 <= k ; i += 8 )
+        _mm512_storeu_pd(out + i, _mm512_fmadd_pd(va, _mm512_loadu_pd(a + i), _mm512_mul_pd(vb, _mm512_loadu_pd(b + i))));
+#elif defined(__AVX2__)
+    __m256d va = _mm256_set1_pd(alpha);
+    __m256d vb = _mm256_set1_pd(beta);
+    for( ; i + 4 <= k ; i += 4 )
+        _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_mul_pd(va, _mm256_loadu_pd(a + i)), _mm256_mul_pd(vb, _mm256_loadu_pd(b + i))));
+#endif
+    for( ; i < k ; i++ )
+        out[i] = alpha * a[i] + beta * b[i];
+}
+
+// out = alpha * x
+inline void scale_coeffs(double alpha, const double *x, double *out, size_t k){
+    size_t i = 0;
+#if defined(__AVX512F__)
+    __m512d a = _mm512_set1_pd(alpha);
+    for( ; i + 8 <= k ; i += 8 )
+        _mm512_storeu_pd(out + i, _mm512_mul_pd(a, _mm512_loadu_pd(x + i)));
+#elif defined(__AVX2__)
+    __m256d a = _mm256_set1_pd(alpha);
+    for( ; i + 4 <= k ; i += 4 )
+        _mm256_storeu_pd(out + i, _mm256_mul_pd(a, _mm256_loadu_pd(x + i)));
+#endif
+    for( ; i < k ; i++ )
+        out[i] = alpha * x[i];
+}
+
+// Sum of a[i]*b[i]; over one node for norms and products, or over a whole block.
+inline double dot_coeffs(const double *a, const double *b, size_t k){
+    size_t i = 0;
+    double result = 0.0;
+#if defined(__AVX512F__)
+    __m512d acc = _mm512_setzero_pd();
+    for( ; i + 8 <= k ; i += 8 )
+        acc = _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i), acc);
+    result = _mm512_reduce_add_pd(acc);
+#elif defined(__AVX2__)
+    __m256d acc = _mm256_setzero_pd();
+    for( ; i + 4 <= k ; i += 4 )
+        acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for( ; i < k ; i++ )
+        result = result + a[i] * b[i];
+    return result;
+}
+
+// Two blocks have the same structure when their leaf flags match slot for slot.
+inline bool same_structure(const bool *leaf1, const bool *leaf2, size_t count){
+    return memcmp(leaf1, leaf2, count * sizeof(bool)) == 0;
+}
+
+// For count nodes of k coefficients each: out = alpha*v1 + beta*v2 on leaves and 0 on interior
+// nodes. out may be v1, for an update in place.
+inline void axpby_leaves(double alpha, const double *v1, double beta, const double *v2, const bool *leaf, double *out, size_t count, size_t k){
+    for( size_t i = 0 ; i < count ; i++ ){
+        if( leaf[i] )
+            axpby_coeffs(alpha, v1 + i * k, beta, v2 + i * k, out + i * k, k);
+        else
+            memset(out + i * k, 0, k * sizeof(double));
+    }
+}
+
+#endif
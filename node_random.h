@@ -0,0 +1,29 @@
+#ifndef NODE_RANDOM_H
+#define NODE_RANDOM_H
+
+// Counter-based random numbers for tree nodes. A draw is a pure function of the seed, the node
+// coordinates (n, l) and a stream number, built from the SplitMix64 finalizer, so point tasks
+// share no generator state and the same seed rebuilds the same tree on any machine and any
+// number of processors.
+
+typedef unsigned long long random_t;
+
+inline random_t splitmix64(random_t x){
+    x = x + 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// Stream 0 is the refinement decision of the node, stream 1+j its coefficient j.
+inline random_t node_random(random_t seed, int n, long long l, int stream){
+    random_t key = splitmix64(seed ^ splitmix64(static_cast<random_t>(n) << 32 | static_cast<random_t>(stream)));
+    return splitmix64(key ^ static_cast<random_t>(l));
+}
+
+// Uniform in [0, 1) from the top 53 bits.
+inline double node_uniform(random_t seed, int n, long long l, int stream){
+    return static_cast<double>(node_random(seed, n, l, stream) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+#endif
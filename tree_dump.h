@@ -0,0 +1,44 @@
+#ifndef TREE_DUMP_H
+#define TREE_DUMP_H
+
+// Binary tree dump format written by Tile_Madness.cc and read by tree_dump_text.cc. A file is
+// a TreeDumpHeader followed by one record per tile, in no particular order since tiles are
+// written in parallel. A record is a TileRecordHeader, a structure bitmap of node_count bits
+// padded to 8 bytes, and node_count * num_coeffs doubles. Both the bits and the values follow
+// the tile's preorder walk: bit i is set when the i-th visited node has children. Set bits on
+// the bottom row of a tile mean the children root tiles with records of their own.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+static const char TREE_DUMP_MAGIC[8] = { 'T', 'M', 'D', 'U', 'M', 'P', '1', '\0' };
+
+struct TreeDumpHeader{
+    char magic[8];
+    int32_t num_coeffs;
+    int32_t max_depth;
+    int32_t tile_height;
+    int32_t reserved;
+};
+
+struct TileRecordHeader{
+    int32_t n;
+    int32_t node_count;
+    int64_t l;
+    int64_t idx;
+};
+
+inline size_t tile_bitmap_bytes(int node_count){
+    return ((node_count + 63) / 64) * 8;
+}
+
+inline size_t tile_record_bytes(int node_count, int num_coeffs){
+    return sizeof(TileRecordHeader) + tile_bitmap_bytes(node_count) + static_cast<size_t>(node_count) * num_coeffs * sizeof(double);
+}
+
+inline bool tile_bit(const unsigned char *bitmap, int i){
+    return (bitmap[i / 8] >> (i % 8)) & 1;
+}
+
+#endif
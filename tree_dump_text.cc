@@ -0,0 +1,102 @@
+// Offline converter from the binary tree dumps of Tile_Madness (tree_dump.h) to the text
+// listing print_task used to write: one line "k: n~l~idx~c0,c1,..." per node, tile by tile in
+// breadth first order and in preorder inside a tile.
+//
+//   g++ -O2 -std=c++11 tree_dump_text.cc -o tree_dump_text
+//   ./tree_dump_text tree1.tmd > tree1.txt
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <map>
+#include <queue>
+#include <vector>
+#include <utility>
+#include "tree_index.h"
+#include "tree_dump.h"
+
+using namespace std;
+
+struct TileNode{
+    int n;
+    tree_idx_t l;
+    tree_idx_t idx;
+};
+
+int main(int argc, char **argv){
+    if( argc != 2 ){
+        cerr<<"usage: "<<argv[0]<<" dump.tmd"<<endl;
+        return 1;
+    }
+    ifstream in(argv[1], ios::binary);
+    vector<char> data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    TreeDumpHeader header;
+    if( data.size() < sizeof(header) ){
+        cerr<<argv[1]<<": not a tree dump"<<endl;
+        return 1;
+    }
+    memcpy(&header, &data[0], sizeof(header));
+    if( memcmp(header.magic, TREE_DUMP_MAGIC, sizeof(header.magic)) != 0 ){
+        cerr<<argv[1]<<": not a tree dump"<<endl;
+        return 1;
+    }
+    int max_depth = header.max_depth;
+    int tile_height = header.tile_height;
+    int num_coeffs = header.num_coeffs;
+
+    // Records come in any order; index them by the (n, l) of their root.
+    map<pair<int, tree_idx_t>, size_t> records;
+    for( size_t offset = sizeof(header) ; offset + sizeof(TileRecordHeader) <= data.size() ; ){
+        TileRecordHeader record;
+        memcpy(&record, &data[offset], sizeof(record));
+        records[make_pair(record.n, static_cast<tree_idx_t>(record.l))] = offset;
+        offset += tile_record_bytes(record.node_count, num_coeffs);
+    }
+
+    static char out_buffer[1 << 20];
+    cout.rdbuf()->pubsetbuf(out_buffer, sizeof(out_buffer));
+    long long node_counter = 0;
+    queue<pair<int, tree_idx_t> > tiles;
+    tiles.push(make_pair(0, static_cast<tree_idx_t>(0)));
+    vector<TileNode> stack;
+    while( !tiles.empty() ){
+        map<pair<int, tree_idx_t>, size_t>::const_iterator found = records.find(tiles.front());
+        tiles.pop();
+        if( found == records.end() ){
+            cerr<<"missing tile record"<<endl;
+            return 1;
+        }
+        TileRecordHeader record;
+        memcpy(&record, &data[found->second], sizeof(record));
+        const unsigned char *bitmap = reinterpret_cast<const unsigned char *>(&data[found->second + sizeof(record)]);
+        const char *values = &data[found->second + sizeof(record) + tile_bitmap_bytes(record.node_count)];
+        int tile_root = record.n;
+        TileNode root = { record.n, record.l, record.idx };
+        stack.assign(1, root);
+        for( int i = 0 ; i < record.node_count ; i++ ){
+            TileNode node = stack.back();
+            stack.pop_back();
+            node_counter++;
+            cout<<node_counter<<": "<<node.n<<"~"<<node.l<<"~"<<node.idx<<"~";
+            for( int j = 0 ; j < num_coeffs ; j++ ){
+                double value;
+                memcpy(&value, values + (static_cast<size_t>(i) * num_coeffs + j) * sizeof(double), sizeof(double));
+                cout<<value<<( j+1 < num_coeffs ? "," : "" );
+            }
+            cout<<'\n';
+            if( !tile_bit(bitmap, i) )
+                continue;
+            if( (node.n % tile_height) == (tile_height-1) ){
+                tiles.push(make_pair(node.n + 1, 2 * node.l));
+                tiles.push(make_pair(node.n + 1, 2 * node.l + 1));
+                continue;
+            }
+            TileNode right = { node.n + 1, 2 * node.l + 1, right_child(max_depth, tile_root, node.n, tile_height, node.idx) };
+            TileNode left = { node.n + 1, 2 * node.l, left_child(node.idx) };
+            stack.push_back(right);
+            stack.push_back(left);
+        }
+    }
+    cout.flush();
+    return 0;
+}
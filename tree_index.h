@@ -0,0 +1,114 @@
+#ifndef TREE_INDEX_H
+#define TREE_INDEX_H
+
+// Index arithmetic for the tiled preorder layout used by Tile_Madness.cc. Everything is
+// integer shifts, so it stays exact for any depth a coord_t can address and needs no libm
+// call per visited node. Kept free of Legion so the microbenchmark can build on its own.
+
+typedef long long tree_idx_t;
+
+constexpr tree_idx_t pow2(int e){
+    return static_cast<tree_idx_t>(1) << e;
+}
+
+// Number of slots in a perfect subtree rooted at depth n of a tree of depth max_depth.
+constexpr tree_idx_t subtree_extent(int max_depth, int n){
+    return pow2(max_depth - n + 1) - 1;
+}
+
+// Tiles are tile_height levels deep except near max_depth, where they are cut short.
+constexpr int tile_levels(int max_depth, int n, int tile_height){
+    return tile_height < max_depth - n + 1 ? tile_height : max_depth - n + 1;
+}
+
+constexpr tree_idx_t tile_extent(int max_depth, int n, int tile_height){
+    return pow2(tile_levels(max_depth, n, tile_height)) - 1;
+}
+
+// Inside a tile block the left child of idx is idx+1 and the right child skips the left
+// subtree of the block.
+constexpr tree_idx_t right_child_offset(int max_depth, int tile_root, int n, int tile_height){
+    return pow2(tile_levels(max_depth, tile_root, tile_height) - (n - tile_root) - 1);
+}
+
+constexpr tree_idx_t left_child(tree_idx_t idx){
+    return idx + 1;
+}
+
+constexpr tree_idx_t right_child(int max_depth, int tile_root, int n, int tile_height, tree_idx_t idx){
+    return idx + right_child_offset(max_depth, tile_root, n, tile_height);
+}
+
+// Child tile j of the tile rooted at tile_root hangs below bottom-row node j/2, on side j%2.
+constexpr int child_tile_position(int tile_root, int n, tree_idx_t l, int side){
+    return static_cast<int>(2 * (l & (pow2(n - tile_root) - 1)) + side);
+}
+
+constexpr tree_idx_t child_tile_idx(int max_depth, int tile_root, tree_idx_t tile_idx, int tile_height, int position){
+    return tile_idx + tile_extent(max_depth, tile_root, tile_height) + position * subtree_extent(max_depth, tile_root + tile_height);
+}
+
+// Preorder index of the node at relative depth r and offset m inside a block of the given
+// number of levels: every step down adds 1, a step to the right also skips the left subtree.
+constexpr tree_idx_t local_idx(int levels, int r, tree_idx_t m){
+    return r == 0 ? 0 : 1 + ( ((m >> (r - 1)) & 1) ? pow2(levels - 1) - 1 : 0 ) + local_idx(levels - 1, r - 1, m & (pow2(r - 1) - 1));
+}
+
+// (n, l) -> idx in a tree of depth max_depth stored with the given tile height.
+constexpr tree_idx_t node_idx(int max_depth, int tile_height, int n, tree_idx_t l, int tile_root = 0, tree_idx_t tile_idx = 0){
+    return n - tile_root < tile_height
+        ? tile_idx + local_idx(tile_levels(max_depth, tile_root, tile_height), n - tile_root, l & (pow2(n - tile_root) - 1))
+        : node_idx(max_depth, tile_height, n, l, tile_root + tile_height,
+                   child_tile_idx(max_depth, tile_root, tile_idx, tile_height,
+                                  static_cast<int>((l >> (n - tile_root - tile_height)) & (pow2(tile_height) - 1))));
+}
+
+// Same arithmetic with the tile height fixed at compile time, so the common heights fold
+// their level counts into constants.
+template<int TILE_HEIGHT>
+struct TileIndex{
+    static constexpr int height(){
+        return TILE_HEIGHT;
+    }
+    static constexpr int levels(int max_depth, int n){
+        return TILE_HEIGHT < max_depth - n + 1 ? TILE_HEIGHT : max_depth - n + 1;
+    }
+    static constexpr tree_idx_t right_child_offset(int max_depth, int tile_root, int n){
+        return pow2(levels(max_depth, tile_root) - (n - tile_root) - 1);
+    }
+    static constexpr tree_idx_t child_tile_idx(int max_depth, int tile_root, tree_idx_t tile_idx, int position){
+        return tile_idx + pow2(levels(max_depth, tile_root)) - 1 + position * subtree_extent(max_depth, tile_root + TILE_HEIGHT);
+    }
+    static constexpr bool is_bottom_row(int n){
+        return n % TILE_HEIGHT == TILE_HEIGHT - 1;
+    }
+};
+
+// The TileIndex interface for a tile height only known at run time, for the other heights.
+struct RuntimeTileIndex{
+    int tile_height;
+    explicit RuntimeTileIndex(int _tile_height) : tile_height(_tile_height) {}
+    int height() const {
+        return tile_height;
+    }
+    int levels(int max_depth, int n) const {
+        return tile_levels(max_depth, n, tile_height);
+    }
+    tree_idx_t right_child_offset(int max_depth, int tile_root, int n) const {
+        return ::right_child_offset(max_depth, tile_root, n, tile_height);
+    }
+    tree_idx_t child_tile_idx(int max_depth, int tile_root, tree_idx_t tile_idx, int position) const {
+        return ::child_tile_idx(max_depth, tile_root, tile_idx, tile_height, position);
+    }
+    bool is_bottom_row(int n) const {
+        return n % tile_height == tile_height - 1;
+    }
+};
+
+static_assert(subtree_extent(3, 0) == 15, "subtree extent");
+static_assert(node_idx(3, 2, 1, 1) == 2, "right child of the root");
+static_assert(node_idx(3, 2, 2, 0) == 3 + 0 * 3 + 0, "first child tile");
+static_assert(node_idx(3, 2, 3, 7) == 3 + 3 * 3 + 2, "last leaf");
+static_assert(node_idx(5, 2, 4, 5) == 3 + 1 * 15 + 3 + 1 * 3, "node two tiles down");
+
+#endif
@@ -0,0 +1,183 @@
+// Microbenchmark for the tree index arithmetic in tree_index.h. It walks every node of a
+// full tiled tree the way the intra tasks do and reports the cost per visited node for the
+// old pow() based arithmetic, the shift based functions and a compile-time tile height.
+//
+//   g++ -O2 -std=c++11 tree_index_bench.cc -o tree_index_bench
+//   ./tree_index_bench [-max_depth 22] [--tile 4] [-reps 5]
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include "tree_index.h"
+
+using namespace std;
+
+struct PowIndex{
+    int tile_height;
+    int levels(int max_depth, int n) const {
+        return min(tile_height, max_depth - n + 1);
+    }
+    tree_idx_t right_child_offset(int max_depth, int tile_root, int n) const {
+        return static_cast<tree_idx_t>(pow(2, levels(max_depth, tile_root) - (n - tile_root) - 1));
+    }
+    tree_idx_t child_tile_idx(int max_depth, int tile_root, tree_idx_t tile_idx, int position) const {
+        return tile_idx + static_cast<tree_idx_t>(pow(2, levels(max_depth, tile_root))) - 1 + position * (static_cast<tree_idx_t>(pow(2, max_depth - tile_root - tile_height + 1)) - 1);
+    }
+    bool is_bottom_row(int n) const {
+        return (n % tile_height) == (tile_height - 1);
+    }
+};
+
+struct ShiftIndex{
+    int tile_height;
+    tree_idx_t right_child_offset(int max_depth, int tile_root, int n) const {
+        return ::right_child_offset(max_depth, tile_root, n, tile_height);
+    }
+    tree_idx_t child_tile_idx(int max_depth, int tile_root, tree_idx_t tile_idx, int position) const {
+        return ::child_tile_idx(max_depth, tile_root, tile_idx, tile_height, position);
+    }
+    bool is_bottom_row(int n) const {
+        return (n % tile_height) == (tile_height - 1);
+    }
+};
+
+template<int TILE_HEIGHT>
+struct FixedIndex{
+    tree_idx_t right_child_offset(int max_depth, int tile_root, int n) const {
+        return TileIndex<TILE_HEIGHT>::right_child_offset(max_depth, tile_root, n);
+    }
+    tree_idx_t child_tile_idx(int max_depth, int tile_root, tree_idx_t tile_idx, int position) const {
+        return TileIndex<TILE_HEIGHT>::child_tile_idx(max_depth, tile_root, tile_idx, position);
+    }
+    bool is_bottom_row(int n) const {
+        return TileIndex<TILE_HEIGHT>::is_bottom_row(n);
+    }
+};
+
+struct Node{
+    int n;
+    tree_idx_t l;
+    tree_idx_t idx;
+    int tile_root;
+    tree_idx_t tile_idx;
+};
+
+// Depth first walk over the full tree; returns a checksum of the visited indices.
+template<typename Index>
+tree_idx_t walk(const Index &index, int max_depth, vector<Node> &stack){
+    tree_idx_t checksum = 0;
+    stack.clear();
+    Node root = {0, 0, 0, 0, 0};
+    stack.push_back(root);
+    while( !stack.empty() ){
+        Node temp = stack.back();
+        stack.pop_back();
+        checksum += temp.idx;
+        if( temp.n == max_depth )
+            continue;
+        for( int side = 1 ; side >= 0 ; side-- ){
+            Node child;
+            child.n = temp.n + 1;
+            child.l = 2 * temp.l + side;
+            if( index.is_bottom_row(temp.n) ){
+                int position = child_tile_position(temp.tile_root, temp.n, temp.l, side);
+                child.tile_root = temp.n + 1;
+                child.tile_idx = index.child_tile_idx(max_depth, temp.tile_root, temp.tile_idx, position);
+                child.idx = child.tile_idx;
+            }
+            else{
+                child.tile_root = temp.tile_root;
+                child.tile_idx = temp.tile_idx;
+                child.idx = side ? temp.idx + index.right_child_offset(max_depth, temp.tile_root, temp.n) : temp.idx + 1;
+            }
+            stack.push_back(child);
+        }
+    }
+    return checksum;
+}
+
+template<typename Index>
+void run(const char *name, const Index &index, int max_depth, int reps){
+    vector<Node> stack;
+    stack.reserve(2 * max_depth + 2);
+    tree_idx_t nodes = subtree_extent(max_depth, 0);
+    double best = 1e30;
+    tree_idx_t checksum = 0;
+    for( int rep = 0 ; rep < reps ; rep++ ){
+        chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+        checksum = walk(index, max_depth, stack);
+        chrono::high_resolution_clock::time_point stop = chrono::high_resolution_clock::now();
+        double ns = chrono::duration<double, nano>(stop - start).count();
+        best = min(best, ns);
+    }
+    cout<<name<<" "<<best/nodes<<" ns/node checksum "<<checksum<<endl;
+}
+
+// Every node must land on a distinct slot and agree with the closed-form (n, l) mapping.
+bool check(int max_depth, int tile_height){
+    tree_idx_t size = subtree_extent(max_depth, 0);
+    vector<int> hits(size, 0);
+    vector<Node> stack;
+    Node root = {0, 0, 0, 0, 0};
+    stack.push_back(root);
+    ShiftIndex index = {tile_height};
+    while( !stack.empty() ){
+        Node temp = stack.back();
+        stack.pop_back();
+        if( temp.idx != node_idx(max_depth, tile_height, temp.n, temp.l) )
+            return false;
+        hits[temp.idx]++;
+        if( temp.n == max_depth )
+            continue;
+        for( int side = 0 ; side < 2 ; side++ ){
+            Node child = {temp.n + 1, 2 * temp.l + side, 0, temp.tile_root, temp.tile_idx};
+            if( index.is_bottom_row(temp.n) ){
+                child.tile_root = temp.n + 1;
+                child.tile_idx = index.child_tile_idx(max_depth, temp.tile_root, temp.tile_idx, child_tile_position(temp.tile_root, temp.n, temp.l, side));
+                child.idx = child.tile_idx;
+            }
+            else
+                child.idx = side ? temp.idx + index.right_child_offset(max_depth, temp.tile_root, temp.n) : temp.idx + 1;
+            stack.push_back(child);
+        }
+    }
+    for( tree_idx_t i = 0 ; i < size ; i++ )
+        if( hits[i] != 1 )
+            return false;
+    return true;
+}
+
+int main(int argc, char **argv){
+    int max_depth = 22;
+    int tile_height = 4;
+    int reps = 5;
+    for( int i = 1 ; i < argc ; i++ ){
+        if( strcmp(argv[i], "-max_depth") == 0 )
+            max_depth = atoi(argv[++i]);
+        else if( strcmp(argv[i], "--tile") == 0 )
+            tile_height = atoi(argv[++i]);
+        else if( strcmp(argv[i], "-reps") == 0 )
+            reps = atoi(argv[++i]);
+    }
+    for( int h = 1 ; h <= 6 ; h++ )
+        if( !check(10, h) ){
+            cout<<"index mismatch for tile height "<<h<<endl;
+            return 1;
+        }
+    cout<<"max_depth "<<max_depth<<" tile_height "<<tile_height<<" nodes "<<subtree_extent(max_depth, 0)<<endl;
+    PowIndex pow_index = {tile_height};
+    ShiftIndex shift_index = {tile_height};
+    run("pow     ", pow_index, max_depth, reps);
+    run("shift   ", shift_index, max_depth, reps);
+    switch( tile_height ){
+        case 2: run("fixed<2>", FixedIndex<2>(), max_depth, reps); break;
+        case 3: run("fixed<3>", FixedIndex<3>(), max_depth, reps); break;
+        case 4: run("fixed<4>", FixedIndex<4>(), max_depth, reps); break;
+        case 8: run("fixed<8>", FixedIndex<8>(), max_depth, reps); break;
+        default: break;
+    }
+    return 0;
+}